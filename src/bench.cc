@@ -0,0 +1,214 @@
+/*
+ * Copyright 2023 Marek Rogalski
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the standard MIT license. See LICENSE for more details.
+ */
+
+////////////////////////////////////////////////////////////////////
+// Headless benchmark that runs the demo stages at various sizes. //
+////////////////////////////////////////////////////////////////////
+
+// Every stage is generated with a fixed seed & simulated for a number of
+// frames. Each frame limits the potential assignments (`LimitAssignments`) &
+// optimizes them (`Optimize`). Both phases are timed separately. The limited
+// assignments are also optimized with each of the engines (the "sparse",
+// "auction" & "auto" phases) so that they can be compared with each other.
+// Small scenes are also optimized without limiting (the "dense" phase).
+//
+// Usage: bench [--json] [--frames N] [--budget SECONDS] [--max-size N]
+//              [--limit K] [--stage NAME]
+//
+// Built natively with `make bench` & for node with `make bench.js` (run it
+// with `node bench.js`) so that both builds can be compared. Solver counters
+// come from COLONY_STATS.
+
+#include "demo_stages.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Scenes bigger than this (characters * tasks) skip the dense phase.
+const int64_t kMaxDensePairs = 1 << 22;
+
+struct Options {
+  bool json = false;
+  int frames = 50;     // frames simulated per scenario
+  double budget = 2;   // seconds after which a scenario stops early
+  int max_size = 5000; // biggest size of the sweep
+  int limit = 5;       // limit per character & per task
+  const char *stage = nullptr; // run only this stage
+};
+
+// Measurements of a phase across the frames of a scenario.
+struct Phase {
+  const char *name = "";
+  vector<double> ms = {}; // time of each frame
+  colony::Stats stats = {};
+};
+
+double Percentile(vector<double> ms, double p) {
+  if (ms.empty()) {
+    return 0;
+  }
+  sort(ms.begin(), ms.end());
+  int rank = (int)ceil(p * ms.size()) - 1;
+  return ms[clamp(rank, 0, (int)ms.size() - 1)];
+}
+
+bool first_row = true;
+
+void Print(const Options &options, const char *stage, int size,
+           const Scene &scene, const Phase &phase) {
+  int samples = phase.ms.size();
+  if (samples == 0) {
+    return;
+  }
+  double p50 = Percentile(phase.ms, 0.5), p99 = Percentile(phase.ms, 0.99);
+  double augmentations = (double)phase.stats.augmentations / samples;
+  double label_updates = (double)phase.stats.label_updates / samples;
+  double bfs_vertices = (double)phase.stats.bfs_vertices / samples;
+  double column_visits = (double)phase.stats.column_visits / samples;
+  double bytes = (double)phase.stats.bytes / samples;
+  double bids = (double)phase.stats.bids / samples;
+  if (options.json) {
+    printf("%s\n  {\"stage\": \"%s\", \"size\": %d, \"characters\": %d, "
+           "\"tasks\": %d, \"phase\": \"%s\", \"samples\": %d, "
+           "\"p50_ms\": %.4f, \"p99_ms\": %.4f, \"augmentations\": %.1f, "
+           "\"label_updates\": %.1f, \"bfs_vertices\": %.1f, "
+           "\"column_visits\": %.0f, \"bytes\": %.0f, \"bids\": %.0f}",
+           first_row ? "[" : ",", stage, size, (int)scene.characters.size(),
+           (int)scene.work.size(), phase.name, samples, p50, p99,
+           augmentations, label_updates, bfs_vertices, column_visits, bytes,
+           bids);
+  } else {
+    if (first_row) {
+      printf("stage,size,characters,tasks,phase,samples,p50_ms,p99_ms,"
+             "augmentations,label_updates,bfs_vertices,column_visits,bytes,"
+             "bids\n");
+    }
+    printf("%s,%d,%d,%d,%s,%d,%.4f,%.4f,%.1f,%.1f,%.1f,%.0f,%.0f,%.0f\n",
+           stage, size, (int)scene.characters.size(), (int)scene.work.size(),
+           phase.name, samples, p50, p99, augmentations, label_updates,
+           bfs_vertices, column_visits, bytes, bids);
+  }
+  first_row = false;
+  fflush(stdout);
+}
+
+void Run(const Options &options, const Stage &stage, int size,
+         colony::Workspace &workspace) {
+  Scene scene;
+  scene.seed = 1;
+  stage.fill(scene, size);
+  Scene initial = scene; // reported sizes are the ones of the first frame
+  Phase limit{"limit"}, optimize{"optimize"}, dense{"dense"};
+  Phase engines[] = {{"sparse"}, {"auction"}, {"auto"}};
+  const colony::Engine kEngines[] = {
+      colony::Engine::Sparse, colony::Engine::Auction, colony::Engine::Auto};
+  vector<colony::Assignment> assignments, dense_assignments;
+  vector<colony::Assignment> limited, solved; // inputs & outputs of engines
+  auto cost = [&](int i, int j) { return scene.Cost(i, j); };
+  auto ms = [](auto start, auto end) {
+    return chrono::duration<double, milli>(end - start).count();
+  };
+  auto scenario_start = chrono::steady_clock::now();
+  for (int frame = 0; frame < options.frames && !scene.work.empty(); ++frame) {
+    int num_characters = scene.characters.size();
+    int num_tasks = scene.work.size();
+
+    auto t0 = chrono::steady_clock::now();
+    colony::LimitAssignments(num_characters, num_tasks, cost, options.limit,
+                             options.limit, assignments, workspace);
+    auto t1 = chrono::steady_clock::now();
+    limited = assignments;
+    workspace.stats = {};
+    colony::Optimize(assignments, workspace);
+    auto t2 = chrono::steady_clock::now();
+    limit.ms.push_back(ms(t0, t1));
+    optimize.ms.push_back(ms(t1, t2));
+    optimize.stats += workspace.stats;
+
+    for (int i = 0; i < 3; ++i) {
+      solved = limited;
+      workspace.stats = {};
+      auto t3 = chrono::steady_clock::now();
+      colony::Optimize(solved, kEngines[i], workspace);
+      auto t4 = chrono::steady_clock::now();
+      engines[i].ms.push_back(ms(t3, t4));
+      engines[i].stats += workspace.stats;
+    }
+
+    if ((int64_t)num_characters * num_tasks <= kMaxDensePairs) {
+      workspace.stats = {};
+      auto t3 = chrono::steady_clock::now();
+      colony::Optimize(num_characters, num_tasks, cost, dense_assignments,
+                       workspace);
+      auto t4 = chrono::steady_clock::now();
+      dense.ms.push_back(ms(t3, t4));
+      dense.stats += workspace.stats;
+    }
+
+    scene.Step(assignments);
+    if (ms(scenario_start, chrono::steady_clock::now()) >
+        options.budget * 1000) {
+      break;
+    }
+  }
+  for (Phase *phase :
+       {&limit, &optimize, &engines[0], &engines[1], &engines[2], &dense}) {
+    Print(options, stage.name, size, initial, *phase);
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--json") == 0) {
+      options.json = true;
+    } else if (value && strcmp(arg, "--frames") == 0) {
+      options.frames = atoi(value), ++i;
+    } else if (value && strcmp(arg, "--budget") == 0) {
+      options.budget = atof(value), ++i;
+    } else if (value && strcmp(arg, "--max-size") == 0) {
+      options.max_size = atoi(value), ++i;
+    } else if (value && strcmp(arg, "--limit") == 0) {
+      options.limit = atoi(value), ++i;
+    } else if (value && strcmp(arg, "--stage") == 0) {
+      options.stage = value, ++i;
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--json] [--frames N] [--budget SECONDS] "
+              "[--max-size N] [--limit K] [--stage NAME]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+#ifndef COLONY_STATS
+  fprintf(stderr, "Built without COLONY_STATS - solver counters are zero.\n");
+#endif
+
+  const int sizes[] = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000};
+  colony::Workspace workspace;
+  for (const Stage &stage : Stages()) {
+    if (options.stage && strcmp(options.stage, stage.name) != 0) {
+      continue;
+    }
+    for (int size : sizes) {
+      if (size <= options.max_size) {
+        Run(options, stage, size, workspace);
+      }
+    }
+  }
+  if (options.json) {
+    printf("%s\n", first_row ? "[]" : "\n]");
+  }
+  return 0;
+}
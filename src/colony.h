@@ -48,27 +48,119 @@ frame. Characters and tasks can be added and removed. Travel costs,
 execution times, failure probabilities and perceived values of tasks
 can change to reflect the game world.
 
+Usually only a few costs change from one frame to the next. `Reoptimize` takes
+advantage of that by starting from the assignment found in the previous frame
+and repairing only the parts of it that were affected by the changes.
+
+Games that already know which characters, tasks & costs changed can report
+them to a `Scheduler` instead (`AddTask`, `RemoveTask`, `UpdateCost`, ...).
+It keeps the cost matrix between frames so `Solve` doesn't even have to look
+at the costs that stayed the same.
+
+Frames with a hard time budget can pass a `Deadline`. When it passes, the
+solver stops & completes the assignment greedily. Its partial work is kept so
+the next `Reoptimize` continues from it.
+
+Characters and tasks are identified by integers. Ideally they should be small
+& dense (indices into some array). Sparse ids are also accepted - they get
+remapped internally to dense indices with an `IdMap`. Games can also use
+`IdMap` directly to turn their (possibly 64-bit) entity ids into indices.
+
+Games which run many separate colonies (for example on a server) can solve
+all of them with a single call to `OptimizeBatch`.
+
 ## Including in C++ projects
 
 The library is written inline in a single header file. Ideally this header
 should be included in a single compilation unit and then linked into the final
 executable.
 
+## Memory
+
+All of the temporary memory used by `Optimize` is kept in a `Workspace`. Its
+buffers only grow so after a couple of frames the solver stops allocating. Keep
+one workspace per thread & pass it to `Optimize`. The overloads that don't take
+a workspace use `DefaultWorkspace()` of the calling thread.
+
+A problem with C characters, T tasks & E potential assignments needs at most
+`C * T * sizeof(Cost)` bytes for the cost matrix (twice that for `Reoptimize`,
+which keeps the matrix of the previous frame) plus less than 64 bytes per
+character, task & assignment. Problems that fall apart into separate groups
+only need the matrices of the groups. Nothing big is put on the stack.
+`MemoryUsage` returns the bytes held by a workspace & `ReleaseMemory` frees
+them.
+
+## Cost types
+
+Solvers are templates parametrized by the type of costs. `Assignment` &
+`Workspace` use `double`. `BasicAssignment<float>` halves the memory used by the
+cost matrix. With `BasicAssignment<int32_t>` (or `int64_t`) costs are compared
+exactly - useful when they are measured in tiles or ticks. Impossible pairs are
+marked with `CostTraits<Cost>::Infinity()` - solvers treat them as missing.
+
+## Lockstep multiplayer
+
+Games where every client runs the simulation should set `deterministic` in
+their workspaces & use integer costs (`FixedPointCost` converts the ones from
+`ComputeCost`). Every client then gets the same assignments - no matter the
+order of the potential assignments, the history of the workspace, the number of
+threads or the platform (native or WebAssembly). Floating-point costs are only
+reproducible between builds that round the same way (for example without
+`-ffast-math` & FMA contraction). A `Scheduler` with a deterministic workspace
+solves from scratch on every `Solve`.
+
 ## Complexity
 
 Task assignment relies on the Hungarian algorithm which is O(n^3).
 LibColony offers an optional optimization where restricting
 the assignment to only top-n tasks reduces this to O(n^2). Assignment algorithm
-is pretty optimized so even the O(n^3) variant should work fine for games with
+is pretty optimized (its inner loops use SIMD instructions when they're
+available) so even the O(n^3) variant should work fine for games with
 hundreds of units & tasks. Only when the number of units goes into thousands,
 the optimization becomes useful.
 
+The dense solver can also use many threads. Set the `executor` of the
+workspace (for example to a `ThreadPool`) & its passes over the tasks are split
+into jobs. The matching is the same as the one found by a single thread.
+
+Note that `Optimize` works on dense matrices of characters & tasks. When the
+problem falls apart into independent groups (connected components), each group
+gets its own (smaller) matrix. After restricting the assignments use
+`OptimizeSparse` which only looks at the given assignments. Its cost scales with
+the number of assignments instead.
+
+`Optimize` can also be given an `Engine`. Besides the dense & sparse solvers
+there is an auction solver which is the fastest when there are thousands of
+characters & tasks competing for each other. `Engine::Auto` picks one of them
+based on the size & density of the problem. `bench` compares them on the demo
+scenarios.
+
+When costs are dominated by travel time, `SpatialCandidates` can generate the
+potential assignments between each character & its nearest tasks directly, so
+the costs of the remaining pairs never have to be computed.
+
 ## Stability of assignments
 
 In some scenarios the assignment may be flapping between two equally
-good tasks. In order to stick to one of them, the costs (travel or
-execution) of the assigned task should be decreasing a bit on every
-frame.
+good tasks. In order to stick to one of them, pass the assignment of the
+previous frame & a `switching_penalty` to `Optimize` (or `Reoptimize`).
+Characters switch tasks only when it saves more than the penalty.
+
+## Vital tasks
+
+Dividing the costs by priorities (as `ComputeCost` does) makes vital tasks
+attractive but doesn't guarantee that they're done - and huge priority ratios
+squash the costs of the other tasks together. `OptimizeTiered` takes the tier
+of each task instead. Characters are assigned to the tasks of tier 0 first
+(optimally) & only the remaining ones get the tasks of the following tiers.
+
+## What-if queries
+
+After a dense solve the workspace holds the marginal value of every character
+& task (the duals of the assignment problem). `CharacterValue`, `TaskValue`,
+`BreakEvenCost` & `MayChange` use them to tell in O(1) per pair whether a new
+task (or a cheaper pair) can change the assignment & how cheap a pair has to
+be in order to get picked - without solving the problem again.
 
 ## Hauling & delivery
 
@@ -77,6 +169,19 @@ per frame. The first execution should assign resources to delivery
 destinations. This assignment creates the "delivery tasks" for the
 second execution where characters are assigned to the tasks.
 
+`OptimizeHauling` runs both stages in a single call.
+
+## Huge maps
+
+On huge maps most pairs of characters & tasks are too far apart to matter.
+`OptimizeZones` splits the map into zones (with labels of the game, for
+example rooms, or with the cells of a grid) & assigns in two steps. First a
+small problem decides how many (and which) pawns go to each zone, so that busy
+zones don't run out of pawns. Then every zone is solved on its own - in
+parallel if its workspace has an `executor`. Zones that didn't change since the
+previous frame aren't solved again. The result may be a little worse than the
+one of `Optimize` - `ZoneWorkspace::measure_gap` tells by how much.
+
 ## Long-term planning
 
 Sometimes a single pawn can execute many tasks alone faster than many (slower)
@@ -99,25 +204,73 @@ these pawns. The final long-term plan consits of the tasks which were finished
 during this process (assigned to the pawns which completed them) and then to the
 tasks which they were assigned in the final assignment.
 
+`PlanAhead` implements this loop. Each repetition changes only one pawn & one
+task so it warm-starts the solver from the previous assignment. Its time budget
+bounds the solves as well.
+
 ## Personal tasks
 
 Tasks in LibColony can be executed by one character at a time. To
 support tasks which can be done by many characters, create an instance
 of that task for each character.
 
+Alternatively `OptimizeCapacitated` takes the number of characters that can
+work on each task (and the number of tasks that each character can take). It
+solves the problem as a flow so the copies don't have to be made.
+
 */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
 #include <functional>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+// The inner loops of the dense solver use the vector extensions of GCC & Clang
+// when the target has SIMD instructions (SSE2, AVX, NEON or WebAssembly SIMD).
+// Define COLONY_NO_SIMD to use the scalar loops instead.
+#if !defined(COLONY_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) &&   \
+    (defined(__SSE2__) || defined(__ARM_NEON) || defined(__wasm_simd128__))
+#define COLONY_SIMD 1
+#if defined(__AVX__)
+#define COLONY_SIMD_BYTES 32
+#else
+#define COLONY_SIMD_BYTES 16
+#endif
+#endif
+
+// Define COLONY_STATS to make the solvers count their work in the `stats` of
+// their workspace (see `Stats`). Define COLONY_TRACE to get the phases of the
+// solvers reported to `colony::trace`. Without them the instrumentation
+// compiles away.
+#ifdef COLONY_STATS
+#define COLONY_STAT(ws, counter, n) ((ws).stats.counter += (n))
+#else
+#define COLONY_STAT(ws, counter, n) ((void)0)
+#endif
+#if defined(COLONY_STATS) || defined(COLONY_TRACE)
+#define COLONY_PHASE(ws, phase)                                                \
+  ::colony::internal::PhaseScope colony_phase((ws).stats,                      \
+                                              ::colony::Stats::phase)
+#else
+#define COLONY_PHASE(ws, phase) ((void)0)
+#endif
+
 namespace colony {
 
 // This is a helper function that computes the cost of a task taking into
@@ -144,119 +297,985 @@ inline double ComputeCost(double travel_time = 0, double work_time = 0,
 typedef int CharacterId;
 typedef int TaskId;
 
-struct Assignment {
+// Point in time at which the solvers should give up (see `Optimize`). The
+// default (`Deadline::max()`) never passes.
+typedef std::chrono::steady_clock::time_point Deadline;
+
+// Algorithm used by `Optimize` (see its variant that takes an `Engine`).
+enum class Engine {
+  Auto,    // picks one of the engines below based on the size & density
+  Dense,   // Hungarian algorithm over the (per component) cost matrix
+  Sparse,  // successive shortest paths over the given assignments
+  Auction, // auction algorithm with epsilon scaling over the assignments
+};
+
+// Potential assignment of a character to a task.
+//
+// Solvers are templated on the type of costs. `float`, `double`, `int32_t` &
+// `int64_t` are supported. Integer costs are compared exactly - they should
+// stay a few times below the maximum of their type so that the labels of the
+// solver don't overflow. `Assignment` (with `double` costs) is the default.
+template <typename Cost> struct BasicAssignment {
   CharacterId character;
   TaskId task;
-  double cost;
+  Cost cost;
 };
 
-// Reduce the number of potential assignments for each character & task.
-inline void LimitAssignments(std::vector<Assignment> &assignments,
-                             int limit_per_character, int limit_per_task) {
-  sort(
-      assignments.begin(), assignments.end(),
-      [](const Assignment &a, const Assignment &b) { return a.cost < b.cost; });
-  CharacterId last_character = -1;
-  TaskId last_task = -1;
-  for (auto &a : assignments) {
-    last_character = std::max(last_character, a.character);
-    last_task = std::max(last_task, a.task);
+typedef BasicAssignment<double> Assignment;
+
+// Potential assignments stored as separate columns (structure of arrays) - 8
+// bytes per assignment plus the cost. Solvers only read the id columns until
+// they know which rows are optimal. Columns map directly onto typed arrays
+// (for example JavaScript `Uint32Array` & `Float32Array`).
+template <typename Cost> struct BasicAssignmentBuffer {
+  std::vector<uint32_t> characters;
+  std::vector<uint32_t> tasks;
+  std::vector<Cost> costs;
+
+  size_t size() const { return costs.size(); }
+  bool empty() const { return costs.empty(); }
+
+  void clear() {
+    characters.clear();
+    tasks.clear();
+    costs.clear();
   }
-  int tasks_per_character[last_character + 1];
-  int characters_per_task[last_task + 1];
-  for (int i = 0; i <= last_character; ++i) {
-    tasks_per_character[i] = 0;
+
+  void reserve(size_t n) {
+    characters.reserve(n);
+    tasks.reserve(n);
+    costs.reserve(n);
   }
-  for (int i = 0; i <= last_task; ++i) {
-    characters_per_task[i] = 0;
+
+  void push_back(const BasicAssignment<Cost> &a) {
+    characters.push_back(a.character);
+    tasks.push_back(a.task);
+    costs.push_back(a.cost);
   }
 
-  for (int i = 0; i < assignments.size(); ++i) {
-    auto &a = assignments[i];
-    if (tasks_per_character[a.character] >= limit_per_character) {
-      std::swap(a, assignments.back());
-      assignments.pop_back();
-      --i;
-      continue;
+  BasicAssignment<Cost> operator[](size_t i) const {
+    return {(CharacterId)characters[i], (TaskId)tasks[i], costs[i]};
+  }
+};
+
+typedef BasicAssignmentBuffer<double> AssignmentBuffer;
+
+// Read-only view of assignment columns - either of a `BasicAssignmentBuffer`
+// or of arrays that live somewhere else. All columns must have the same size.
+template <typename Cost> struct BasicAssignmentColumns {
+  std::span<const uint32_t> characters;
+  std::span<const uint32_t> tasks;
+  std::span<const Cost> costs;
+
+  BasicAssignmentColumns(std::span<const uint32_t> characters,
+                         std::span<const uint32_t> tasks,
+                         std::span<const Cost> costs)
+      : characters(characters), tasks(tasks), costs(costs) {}
+  BasicAssignmentColumns(const BasicAssignmentBuffer<Cost> &buffer)
+      : characters(buffer.characters), tasks(buffer.tasks),
+        costs(buffer.costs) {}
+
+  size_t size() const { return costs.size(); }
+
+  BasicAssignment<Cost> operator[](size_t i) const {
+    return {(CharacterId)characters[i], (TaskId)tasks[i], costs[i]};
+  }
+};
+
+typedef BasicAssignmentColumns<double> AssignmentColumns;
+
+// Arithmetic of the cost types supported by the solvers.
+template <typename Cost, bool = std::is_integral<Cost>::value>
+struct CostTraits {
+  // Cost of the impossible pairs.
+  static constexpr Cost Infinity() {
+    return std::numeric_limits<Cost>::infinity();
+  }
+
+  // Labels of the solver accumulate rounding errors so they're compared with
+  // a tolerance. It's relative for `float` which can't represent the absolute
+  // one at bigger magnitudes.
+  static bool Eq(Cost a, Cost b) {
+    Cost tolerance = 0.0001;
+    if (sizeof(Cost) < sizeof(double))
+      tolerance *= std::max({Cost(1), std::abs(a), std::abs(b)});
+    return std::abs(a - b) < tolerance;
+  }
+};
+
+template <typename Cost> struct CostTraits<Cost, true> {
+  static constexpr Cost Infinity() { return std::numeric_limits<Cost>::max(); }
+  static bool Eq(Cost a, Cost b) { return a == b; }
+};
+
+// Converts `cost` (for example from `ComputeCost`) to an integer cost with
+// `scale` units per unit of `cost`. Infinite costs (and the ones too big for
+// `Cost`) become `CostTraits<Cost>::Infinity()`. Rounding is exact so every
+// platform gets the same integers.
+template <typename Cost = int64_t>
+inline Cost FixedPointCost(double cost, double scale) {
+  double scaled = std::round(cost * scale);
+  if (!(scaled < (double)CostTraits<Cost>::Infinity())) {
+    return CostTraits<Cost>::Infinity();
+  }
+  return (Cost)std::max(scaled, (double)std::numeric_limits<Cost>::lowest());
+}
+
+// Maps arbitrary ids (for example 64-bit entity ids) to dense indices.
+//
+// The size of the problems solved by LibColony depends on the largest
+// character & task id. Games that use bigger ids can register them here and use
+// the indices instead. Indices of removed ids are recycled so the largest index
+// stays below the peak number of ids registered at the same time.
+//
+// `Insert`, `Remove` & `Find` are O(1).
+template <typename Id> class IdMap {
+public:
+  // Returns the index of `id`, registering it if necessary.
+  int Insert(Id id) {
+    auto [it, inserted] = index_.try_emplace(id, 0);
+    if (!inserted) {
+      return it->second;
     }
-    if (characters_per_task[a.task] >= limit_per_task) {
-      std::swap(a, assignments.back());
-      assignments.pop_back();
-      --i;
-      continue;
+    if (free_.empty()) {
+      it->second = ids_.size();
+      ids_.push_back(id);
+      live_.push_back(true);
+    } else {
+      it->second = free_.back();
+      free_.pop_back();
+      ids_[it->second] = id;
+      live_[it->second] = true;
+    }
+    return it->second;
+  }
+
+  // Unregisters `id`. Its index will be reused by one of the future ids.
+  void Remove(Id id) {
+    auto it = index_.find(id);
+    if (it == index_.end()) {
+      return;
+    }
+    live_[it->second] = false;
+    free_.push_back(it->second);
+    index_.erase(it);
+  }
+
+  // Returns the index of `id` or -1 if it wasn't registered.
+  int Find(Id id) const {
+    auto it = index_.find(id);
+    return it == index_.end() ? -1 : it->second;
+  }
+
+  // Returns the id registered under `index`.
+  Id operator[](int index) const { return ids_[index]; }
+
+  // Whether `index` is currently used by some id.
+  bool IsLive(int index) const {
+    return index < (int)live_.size() && live_[index];
+  }
+
+  // Number of registered ids.
+  int Size() const { return index_.size(); }
+
+  // All indices are smaller than this.
+  int Capacity() const { return ids_.size(); }
+
+  void Clear() {
+    index_.clear();
+    ids_.clear();
+    live_.clear();
+    free_.clear();
+  }
+
+  // Approximate number of bytes held by the map.
+  size_t MemoryUsage() const {
+    return index_.bucket_count() * sizeof(void *) +
+           index_.size() * (sizeof(std::pair<const Id, int>) + sizeof(void *)) +
+           ids_.capacity() * sizeof(Id) + live_.capacity() +
+           free_.capacity() * sizeof(int);
+  }
+
+private:
+  std::unordered_map<Id, int> index_;
+  std::vector<Id> ids_;
+  std::vector<char> live_;
+  std::vector<int> free_;
+};
+
+// Runs `job(i)` for every i in [0, num_jobs) & returns when all of them are
+// done. Jobs may run concurrently - for example on the threads of the job
+// system of a game engine or on a `ThreadPool`.
+typedef std::function<void(int num_jobs, const std::function<void(int)> &job)>
+    Executor;
+
+// Persistent pool of threads that can be used as an `Executor`.
+//
+// The calling thread also runs jobs so a pool of `num_threads` starts
+// `num_threads - 1` threads. Many threads can share a pool - their calls of
+// `Run` take turns. Jobs that call `Run` of their own pool (for example the
+// components of a problem solved by `OptimizeBatch`) run it inline.
+class ThreadPool {
+public:
+  explicit ThreadPool(int num_threads = std::thread::hardware_concurrency()) {
+    for (int i = 1; i < num_threads; ++i) {
+      threads_.emplace_back([this] { Work(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Runs `job(i)` for every i in [0, num_jobs). Returns when all are done.
+  void Run(int num_jobs, const std::function<void(int)> &job) {
+    if (Current() == this) { // nested - the workers are busy with our caller
+      for (int i = 0; i < num_jobs; ++i) {
+        job(i);
+      }
+      return;
+    }
+    std::lock_guard<std::mutex> turn(run_mutex_);
+    ThreadPool *outer = std::exchange(Current(), this);
+    std::unique_lock<std::mutex> lock(mutex_);
+    job_ = &job;
+    num_jobs_ = num_jobs;
+    next_ = 0;
+    ++generation_;
+    lock.unlock();
+    wake_.notify_all();
+    RunJobs(job, num_jobs);
+    lock.lock();
+    idle_.wait(lock, [&] { return active_ == 0; });
+    job_ = nullptr;
+    Current() = outer;
+  }
+
+  // Executor that runs the jobs on this pool.
+  Executor AsExecutor() {
+    return [this](int num_jobs, const std::function<void(int)> &job) {
+      Run(num_jobs, job);
+    };
+  }
+
+private:
+  // Pool whose jobs run on the calling thread.
+  static ThreadPool *&Current() {
+    thread_local ThreadPool *pool = nullptr;
+    return pool;
+  }
+
+  void RunJobs(const std::function<void(int)> &job, int num_jobs) {
+    for (int i; (i = next_.fetch_add(1)) < num_jobs;) {
+      job(i);
+    }
+  }
+
+  void Work() {
+    Current() = this;
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock,
+                 [&] { return stop_ || (job_ && generation_ != seen); });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+      const std::function<void(int)> &job = *job_;
+      int num_jobs = num_jobs_;
+      ++active_;
+      lock.unlock();
+      RunJobs(job, num_jobs);
+      lock.lock();
+      if (--active_ == 0) {
+        idle_.notify_all();
+      }
+    }
+  }
+
+  std::vector<std::thread> threads_;
+  std::mutex run_mutex_; // held by the thread inside `Run`
+  std::mutex mutex_;
+  std::condition_variable wake_; // signals new jobs (or `stop_`)
+  std::condition_variable idle_; // signals that workers left `RunJobs`
+  const std::function<void(int)> *job_ = nullptr; // null when not running
+  int num_jobs_ = 0;
+  std::atomic<int> next_{0}; // next job to run
+  uint64_t generation_ = 0;  // number of calls to `Run`
+  int active_ = 0;           // workers inside `RunJobs`
+  bool stop_ = false;
+};
+
+// Work done by the solvers. Counted only when compiled with COLONY_STATS.
+// Counters keep growing across calls - reset them with `stats = {}`.
+struct Stats {
+  // Phases of the solvers. They can nest - for example `kAugmentDense`
+  // includes `kUpdateLabels` & `kSolveComponents` includes the solves of all
+  // components.
+  enum Phase {
+    kCompactIds,
+    kSolveComponents,
+    kFillDense,
+    kRepairDense,
+    kAugmentDense,
+    kUpdateLabels,
+    kFilterDense,
+    kEmitDense,
+    kLimitAssignments,
+    kSolveSparse,
+    kSolveAuction,
+    kNumPhases
+  };
+  static constexpr const char *kPhaseNames[kNumPhases] = {
+      "CompactIds",   "SolveComponents", "FillDense",        "RepairDense",
+      "AugmentDense", "UpdateLabels",    "FilterDense",      "EmitDense",
+      "LimitAssignments", "SolveSparse", "SolveAuction"};
+
+  int64_t augmentations = 0; // augmenting paths found
+  int64_t label_updates = 0; // improvements of the labeling
+  int64_t bfs_vertices = 0;  // X vertices added to the alternating trees
+  int64_t column_visits = 0; // columns visited by the passes over the slacks
+  int64_t bytes = 0; // bytes read by the passes over the columns (estimate)
+  int64_t bids = 0;  // bids placed by the auction solver
+  double phase_ms[kNumPhases] = {}; // time spent in each phase
+
+  Stats &operator+=(const Stats &other) {
+    augmentations += other.augmentations;
+    label_updates += other.label_updates;
+    bfs_vertices += other.bfs_vertices;
+    column_visits += other.column_visits;
+    bytes += other.bytes;
+    bids += other.bids;
+    for (int i = 0; i < kNumPhases; ++i) {
+      phase_ms[i] += other.phase_ms[i];
     }
-    ++tasks_per_character[a.character];
-    ++characters_per_task[a.task];
+    return *this;
+  }
+};
+
+#ifdef COLONY_TRACE
+// Hooks called at the beginning & end of each phase of the solvers (see
+// `Stats::Phase`) - for example to open & close Tracy or Perfetto zones.
+// `name` is a string literal. Hooks may be called from many threads at once
+// when the solvers run in parallel.
+struct Trace {
+  void (*begin)(const char *name) = nullptr;
+  void (*end)(const char *name) = nullptr;
+};
+
+inline Trace trace;
+#endif
+
+namespace internal {
+
+// Prices of the auction solver. Integer costs are scaled up so that the last
+// round of the auction can be exact.
+template <typename Cost>
+using Price =
+    std::conditional_t<std::is_integral<Cost>::value, int64_t, double>;
+
+#if defined(COLONY_STATS) || defined(COLONY_TRACE)
+// Reports the phase that lasts until the end of the enclosing scope.
+class PhaseScope {
+public:
+  PhaseScope(Stats &stats, Stats::Phase phase) : stats_(stats), phase_(phase) {
+#ifdef COLONY_TRACE
+    if (trace.begin)
+      trace.begin(Stats::kPhaseNames[phase]);
+#endif
+#ifdef COLONY_STATS
+    start_ = std::chrono::steady_clock::now();
+#endif
+  }
+
+  ~PhaseScope() {
+#ifdef COLONY_STATS
+    stats_.phase_ms[phase_] += std::chrono::duration<double, std::milli>(
+                                   std::chrono::steady_clock::now() - start_)
+                                   .count();
+#endif
+#ifdef COLONY_TRACE
+    if (trace.end)
+      trace.end(Stats::kPhaseNames[phase_]);
+#endif
   }
+
+private:
+  Stats &stats_;
+  Stats::Phase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+#endif
+
+} // namespace internal
+
+template <typename Cost> struct BasicBatchWorkspace;
+
+// Memory used by `Optimize`.
+//
+// Buffers held by the workspace only grow. Once the problem size stabilizes,
+// `Optimize` doesn't allocate anything & doesn't put anything big on the stack.
+// Keep one workspace per thread and reuse it across frames. Costs (and labels)
+// are stored as `Cost`.
+template <typename Cost> struct BasicWorkspace {
+  std::vector<Cost> value;  // value[x * NY + y] - weight of the (x, y) edge
+  std::vector<Cost> lx, ly; // labels of X and Y parts
+  std::vector<int> xy;      // xy[x] - vertex that is matched with x,
+  std::vector<int> yx;      // yx[y] - vertex that is matched with y
+  std::vector<char> S, T;   // sets S and T in algorithm
+  std::vector<Cost> slack;  // as in the algorithm description
+  std::vector<int> slackx;  // slackx[y] such a vertex, that
+  // l(slackx[y]) + l(y) - w(slackx[y],y) = slack[y]
+  std::vector<int> prev; // array for memorizing alternating paths
+  std::vector<int> q;    // queue for bfs
+  std::vector<int> pending; // rows added to S whose slacks aren't updated yet
+
+  // Parallel mode of the dense solver. When `executor` is set, passes over the
+  // columns are split into jobs of at least `columns_per_job` columns. Columns
+  // are processed independently (and merged in order) so the matching is the
+  // same as in the serial mode.
+  Executor executor;
+  int columns_per_job = 1024;
+  std::vector<std::vector<std::pair<int, int>>> hits; // columns found by jobs
+  std::vector<Cost> job_min; // smallest slack found by each job
+  std::vector<int> job_next; // next hit of each job to merge
+
+  mutable Stats stats; // filled only when compiled with COLONY_STATS
+
+  // Deterministic mode for lockstep multiplayer. The result depends only on
+  // the potential assignments - not on their order, nor on the earlier calls
+  // (`Reoptimize` solves from scratch), nor on the `executor` or the SIMD
+  // width. Vectors of potential assignments are sorted by ids (duplicated
+  // pairs keep the cheapest cost) & so are the results. With integer costs
+  // (see `FixedPointCost`) native & WebAssembly builds produce the same
+  // results.
+  bool deterministic = false;
+
+  // Anytime mode of the dense solver. After the `deadline` the solver stops
+  // looking for augmenting paths & completes the matching greedily. `optimal`
+  // tells whether the last solve finished before the deadline.
+  Deadline deadline = Deadline::max();
+  bool optimal = true;
+  std::vector<int> greedy_xy; // matching before the greedy completion
+  std::vector<int> greedy_x;  // X vertices that the greedy completion visits
+
+  // Result of the last dense solve. `Reoptimize` starts from it.
+  std::vector<Cost> prev_value; // value matrix of the last solve
+  std::vector<int> dirty_x; // X vertices that need to be repaired
+  std::vector<int> dirty_y; // Y vertices whose labels were reset to zero
+  int NX = 0, NY = 0;             // size of the last problem
+  bool transpose = false;         // whether X were tasks in the last problem
+  bool warm = false; // whether labels & matching are left from the last solve
+  Cost max_cost = 0; // cost of the missing pairs in the last problem
+
+  // Ids of characters & tasks in the last problem with sparse ids. They are
+  // kept across frames so that `Reoptimize` sees consistent indices.
+  IdMap<CharacterId> character_ids;
+  IdMap<TaskId> task_ids;
+  std::vector<char> seen; // ids that appeared in the current problem
+  bool compact = false;   // whether the last problem used the maps above
+
+  // Connected components (see `SolveComponents`). Problems whose graph falls
+  // apart are solved one component at a time unless `split_components` is
+  // cleared. With the `executor` the components are solved in parallel.
+  bool split_components = true;
+  std::vector<int> component_parent; // union-find forest over all vertices
+  std::vector<int> component;        // component of each vertex (-1 unused)
+  std::vector<int> component_index;  // index of each vertex in its component
+  std::vector<int> component_start;  // component k is [start[k], start[k+1])
+  std::vector<int> component_characters; // number of characters in each one
+  std::vector<int> component_vertices;   // characters & tasks of each one
+  std::unique_ptr<BasicBatchWorkspace<Cost>> components; // solves them
+
+  // Sparse solver (see `OptimizeSparse`). Edges are stored in CSR format.
+  std::vector<int> row_start;  // edges of x are [row_start[x], row_start[x+1])
+  std::vector<int> edge_x, edge_y;    // endpoints of each edge
+  std::vector<Cost> edge_cost;         // cost of each edge
+  std::vector<int> edge_assignment;    // index of each edge in the input
+  std::vector<Cost> px, py;            // potentials of X and Y parts
+  std::vector<int> xe;   // xe[x] - edge matched with x (-1 unassigned)
+  std::vector<Cost> dist;              // distance of Y vertices from the root
+  std::vector<int> ye;   // ye[y] - edge through which y was reached
+  std::vector<int> touched;            // Y vertices reached from the root
+  std::vector<std::pair<Cost, int>> heap; // Y vertices ordered by distance
+
+  // Capacities (see `OptimizeCapacitated`). Uses the CSR edges of the sparse
+  // solver. Vertices are X vertices followed by Y vertices.
+  std::vector<int> capacity;      // units of each vertex
+  std::vector<int> column_start;  // edges of y are column_edge[column_start[y]
+  std::vector<int> column_edge;   // ... column_start[y+1])
+  std::vector<char> edge_flow;    // whether each edge is used
+  std::vector<int> load;          // units of each Y vertex in use
+  std::vector<Cost> potential;    // potential of each vertex
+  std::vector<int> parent_edge;   // edge through which each vertex was reached
+
+  // Auction solver (see `Engine::Auction`). Uses the CSR edges of the sparse
+  // solver & the column edges above.
+  std::vector<internal::Price<Cost>> benefit; // scaled savings of each edge
+  std::vector<internal::Price<Cost>> price;   // price of each Y vertex
+  std::vector<internal::Price<Cost>> profit;  // profit of each X vertex
+
+  // `LimitAssignments`.
+  std::vector<BasicAssignment<Cost>> scratch; // grouped by character or task
+  std::vector<BasicAssignment<Cost>> rows; // rows of `BasicAssignmentColumns`
+  std::vector<int> group_start; // boundaries of the groups in `scratch`
+  std::vector<int> group_size;  // number of assignments kept in each group
+  // Groups of sparse ids. Separate from `character_ids` & `task_ids` so that
+  // the indices of `Reoptimize` stay stable.
+  IdMap<CharacterId> group_characters;
+  IdMap<TaskId> group_tasks;
+
+  // Assignments of the previous frame (see `Optimize` with a
+  // `switching_penalty`). Sorted by character.
+  std::vector<BasicAssignment<Cost>> incumbents;
+  std::vector<int> incumbent_slot; // index of each character's incumbent
+  bool incumbents_sparse = false;  // whether to binary search `incumbents`
+  std::vector<Cost> incumbent_cost; // cost of each incumbent without the bonus
+
+  // `PlanAhead`.
+  std::vector<Cost> plan_cost;    // plan_cost[c * num_tasks + t]
+  std::vector<Cost> busy_until;   // when each character finishes its plan
+  std::vector<TaskId> last_task;  // last task planned for each character
+};
+
+typedef BasicWorkspace<double> Workspace;
+
+// Workspace used by the overloads that don't take one explicitly.
+template <typename Cost = double>
+inline BasicWorkspace<Cost> &DefaultWorkspace() {
+  static thread_local BasicWorkspace<Cost> workspace;
+  return workspace;
 }
 
-// The main function of this library. It takes a vector of potential assigments
-// of characters to tasks and removes all assignments that are not optimal.
-inline void Optimize(std::vector<Assignment> &assignments) {
+namespace internal {
 
-  // Convert the problem into max-value assignment.
-  CharacterId max_character = 0;
-  TaskId max_task = 0;
-  double max_cost = 0;
-  for (auto &a : assignments) {
-    max_character = std::max(max_character, a.character);
-    max_task = std::max(max_task, a.task);
-    max_cost = std::max(max_cost, a.cost);
+template <typename Cost> inline bool Eq(Cost a, Cost b) {
+  return CostTraits<Cost>::Eq(a, b);
+}
+
+// Whether the deadline of the workspace has passed.
+template <typename Cost> inline bool Expired(const BasicWorkspace<Cost> &ws) {
+  return ws.deadline != Deadline::max() &&
+         std::chrono::steady_clock::now() >= ws.deadline;
+}
+
+// Prepares the buffers of the dense solver for a problem of the given size.
+template <typename Cost>
+inline void ResizeDense(BasicWorkspace<Cost> &ws, int NX, int NY) {
+  ws.lx.resize(NX);
+  ws.ly.resize(NY);
+  ws.xy.resize(NX);
+  ws.yx.resize(NY);
+  ws.S.resize(NX);
+  ws.T.resize(NY);
+  ws.slack.resize(NY);
+  ws.slackx.resize(NY);
+  ws.prev.resize(NX);
+  ws.q.resize(NX);
+  ws.NX = NX;
+  ws.NY = NY;
+}
+
+// Starts the dense solver from scratch: X labels equal to the best value of
+// each X vertex & a greedy matching of the tight edges.
+template <typename Cost>
+inline void ResetDense(BasicWorkspace<Cost> &ws, int NX, int NY) {
+  ResizeDense(ws, NX, NY);
+  std::fill(ws.ly.begin(), ws.ly.end(), Cost(0));
+  std::fill(ws.xy.begin(), ws.xy.end(), -1);
+  std::fill(ws.yx.begin(), ws.yx.end(), -1);
+  const Cost *value = ws.value.data();
+  for (int x = 0; x < NX; x++) {
+    const Cost *row = value + (size_t)x * NY;
+    Cost best = std::numeric_limits<Cost>::lowest();
+    for (int y = 0; y < NY; y++)
+      best = std::max(best, row[y]);
+    ws.lx[x] = best;
+    // Match x with its best Y vertex if it's still exposed. The edge is tight
+    // so the labels stay valid. Edges that got a bonus (like the ones kept
+    // from the previous frame) usually go in here.
+    int y = 0;
+    while (y < NY && row[y] != best)
+      y++;
+    if (y < NY && ws.yx[y] == -1) {
+      ws.xy[x] = y;
+      ws.yx[y] = x;
+    }
   }
+}
 
-  int NX, NY;
+// Restores the invariants of the Hungarian algorithm after the values of X
+// vertices listed in `ws.dirty_x` have changed. Labels must be feasible
+// (lx[x] + ly[y] >= value[x][y]), matched edges must be tight and exposed Y
+// vertices must have zero labels. Edges that are no longer tight are removed
+// from the matching. The rest of the matching stays intact.
+template <typename Cost>
+inline void RepairRows(BasicWorkspace<Cost> &ws, int NX, int NY) {
+  const Cost *value = ws.value.data();
+  Cost *lx = ws.lx.data(), *ly = ws.ly.data();
+  int *xy = ws.xy.data(), *yx = ws.yx.data();
+  char *queued = ws.S.data();
+  auto &dirty = ws.dirty_x;
+  std::fill(queued, queued + NX, false);
+  for (int x : dirty)
+    queued[x] = true;
+  while (!dirty.empty()) {
+    int x = dirty.back();
+    dirty.pop_back();
+    queued[x] = false;
+    const Cost *row = value + (size_t)x * NY;
+    Cost best = std::numeric_limits<Cost>::lowest();
+    for (int y = 0; y < NY; y++)
+      best = std::max(best, row[y] - ly[y]);
+    lx[x] = best;
+    int y = xy[x];
+    if (y == -1 || Eq(row[y], lx[x] + ly[y]))
+      continue;
+    // The matched edge is no longer tight. Expose both of its vertices. The
+    // label of y drops to zero which may break feasibility of other rows.
+    xy[x] = -1;
+    yx[y] = -1;
+    if (ly[y] == 0)
+      continue;
+    ly[y] = 0;
+    for (int other = 0; other < NX; other++)
+      if (!queued[other] && value[(size_t)other * NY + y] > lx[other]) {
+        queued[other] = true;
+        dirty.push_back(other);
+      }
+  }
+}
 
-  // The algorithm finds the optimal assignment only when NX <= NY.
-  if (max_task > max_character) {
-    NX = max_character + 1;
-    NY = max_task + 1;
-  } else {
-    NX = max_task + 1;
-    NY = max_character + 1;
+// Adds X vertices affected by a change of values in the column `y` to
+// `ws.dirty_x` so that `RepairRows` can fix them.
+template <typename Cost>
+inline void MarkColumnDirty(BasicWorkspace<Cost> &ws, int y) {
+  const Cost *value = ws.value.data();
+  int NX = ws.NX, NY = ws.NY;
+  for (int x = 0; x < NX; ++x)
+    if (value[(size_t)x * NY + y] > ws.lx[x] + ws.ly[y])
+      ws.dirty_x.push_back(x);
+  int x = ws.yx[y];
+  if (x != -1 && !Eq(value[(size_t)x * NY + y], ws.lx[x] + ws.ly[y]))
+    ws.dirty_x.push_back(x);
+}
+
+// Prepares the labels & matching left from the previous problem (of size
+// `old_NX` x `old_NY`) for the new value matrix. `ws.prev_value` must hold the
+// previous value matrix.
+template <typename Cost>
+inline void RepairDense(BasicWorkspace<Cost> &ws, int NX, int NY, int old_NX,
+                        int old_NY) {
+  COLONY_PHASE(ws, kRepairDense);
+  // Columns that disappeared leave their rows exposed.
+  for (int y = NY; y < old_NY; ++y)
+    if (ws.yx[y] != -1 && ws.yx[y] < NX)
+      ws.xy[ws.yx[y]] = -1;
+  ResizeDense(ws, NX, NY);
+  for (int x = old_NX; x < NX; ++x)
+    ws.xy[x] = -1;
+  // Rows that disappeared leave their columns exposed. Exposed columns
+  // (including the new ones) must have zero labels.
+  ws.dirty_y.clear();
+  for (int y = 0; y < NY; ++y) {
+    if (y >= old_NY) {
+      ws.yx[y] = -1;
+      ws.ly[y] = 0;
+      ws.dirty_y.push_back(y);
+    } else if (ws.yx[y] == -1 || ws.yx[y] >= NX) {
+      ws.yx[y] = -1;
+      if (ws.ly[y] != 0) {
+        ws.ly[y] = 0;
+        ws.dirty_y.push_back(y);
+      }
+    }
   }
 
-  double value[NX][NY];
+  // Rows that changed (or may have changed) need to be repaired.
+  const Cost *value = ws.value.data();
+  const Cost *prev_value = ws.prev_value.data();
+  ws.dirty_x.clear();
+  int common_NY = std::min(NY, old_NY);
   for (int x = 0; x < NX; ++x) {
-    for (int y = 0; y < NY; ++y) {
-      value[x][y] = 1.0;
+    const Cost *row = value + (size_t)x * NY;
+    bool changed = x >= old_NX ||
+                   memcmp(row, prev_value + (size_t)x * old_NY,
+                          sizeof(Cost) * common_NY) != 0;
+    // Labels of the new & exposed columns went down to zero. This may break
+    // the feasibility of labels in this row.
+    for (int i = 0; !changed && i < (int)ws.dirty_y.size(); ++i) {
+      int y = ws.dirty_y[i];
+      changed = row[y] > ws.lx[x] + ws.ly[y];
     }
+    if (changed)
+      ws.dirty_x.push_back(x);
   }
+  RepairRows(ws, NX, NY);
+}
 
-  if (max_task > max_character) {
-    for (auto &a : assignments) {
-      value[a.character][a.task] = max_cost - a.cost + 1.0;
+// Kernels of `AugmentDense`. Columns in the set T are marked with infinite
+// slack so that the kernels can tell them apart without a separate mask.
+
+#ifdef COLONY_SIMD
+// Vectors of `Cost` & comparison masks used by the kernels.
+template <typename Cost> struct Vec {
+  static constexpr int kWidth = COLONY_SIMD_BYTES / sizeof(Cost);
+  typedef Cost V __attribute__((vector_size(COLONY_SIMD_BYTES)));
+  typedef typename std::conditional<sizeof(Cost) == 8, int64_t, int32_t>::type
+      Lane;
+  typedef Lane M __attribute__((vector_size(COLONY_SIMD_BYTES)));
+  typedef int64_t Q __attribute__((vector_size(COLONY_SIMD_BYTES)));
+
+  static V Load(const Cost *p) {
+    V v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  static void Store(Cost *p, V v) { memcpy(p, &v, sizeof(v)); }
+  static V Splat(Cost c) {
+    V v = {};
+    for (int i = 0; i < kWidth; ++i)
+      v[i] = c;
+    return v;
+  }
+  static V Select(M m, V a, V b) { return (V)(((M)a & m) | ((M)b & ~m)); }
+  static V Min(V a, V b) { return Select((M)(a < b), a, b); }
+  static V Max(V a, V b) { return Select((M)(a < b), b, a); }
+  static V Abs(V a) { return Select((M)(a < Splat(0)), -a, a); }
+  static bool Any(M m) {
+    Q q = (Q)m;
+    int64_t any = 0;
+    for (int i = 0; i < COLONY_SIMD_BYTES / 8; ++i)
+      any |= q[i];
+    return any != 0;
+  }
+  static int First(M m) {
+    int i = 0;
+    while (!m[i])
+      ++i;
+    return i;
+  }
+  // Lanes where `CostTraits<Cost>::Eq(a, b)`.
+  static M Eq(V a, V b) {
+    if constexpr (std::is_integral<Cost>::value) {
+      return (M)(a == b);
+    } else {
+      V d = a - b;
+      V tolerance = Splat(0.0001);
+      if (sizeof(Cost) < sizeof(double))
+        tolerance *= Max(Splat(1), Max(Abs(a), Abs(b)));
+      return (M)(d < tolerance) & (M)(-tolerance < d);
     }
-  } else {
-    for (auto &a : assignments) {
-      value[a.task][a.character] = max_cost - a.cost + 1.0;
+  }
+};
+#endif
+
+// First column in [y, end) outside of T that is in the equality graph of row
+// `x` (with label `lx`). Returns `end` if there is none.
+template <typename Cost>
+inline int NextTight(const Cost *row, Cost lx, const Cost *ly,
+                     const Cost *slack, int y, int end) {
+  const Cost inf = CostTraits<Cost>::Infinity();
+#ifdef COLONY_SIMD
+  typedef Vec<Cost> W;
+  for (; y + W::kWidth <= end; y += W::kWidth) {
+    auto m = W::Eq(W::Load(row + y), W::Splat(lx) + W::Load(ly + y)) &
+             (typename W::M)(W::Load(slack + y) != W::Splat(inf));
+    if (W::Any(m))
+      return y + W::First(m);
+  }
+#endif
+  for (; y < end; ++y)
+    if (slack[y] != inf && Eq(row[y], lx + ly[y]))
+      return y;
+  return end;
+}
+
+// First column in [y, end) outside of T with zero slack.
+template <typename Cost>
+inline int NextZeroSlack(const Cost *slack, int y, int end) {
+#ifdef COLONY_SIMD
+  typedef Vec<Cost> W;
+  for (; y + W::kWidth <= end; y += W::kWidth) {
+    auto m = W::Eq(W::Load(slack + y), W::Splat(0));
+    if (W::Any(m))
+      return y + W::First(m);
+  }
+#endif
+  for (; y < end; ++y)
+    if (Eq(slack[y], Cost(0)))
+      return y;
+  return end;
+}
+
+// Lowers the slacks of columns [y, end) outside of T after row `x` (with label
+// `lx`) joins the set S.
+template <typename Cost>
+inline void UpdateSlack(const Cost *row, Cost lx, const Cost *ly, Cost *slack,
+                        int *slackx, int x, int y, int end) {
+  const Cost inf = CostTraits<Cost>::Infinity();
+#ifdef COLONY_SIMD
+  typedef Vec<Cost> W;
+  for (; y + W::kWidth <= end; y += W::kWidth) {
+    auto s = W::Splat(lx) + W::Load(ly + y) - W::Load(row + y);
+    auto old = W::Load(slack + y);
+    auto m = (typename W::M)(s < old) & (typename W::M)(old != W::Splat(inf));
+    if (!W::Any(m))
+      continue;
+    W::Store(slack + y, W::Select(m, s, old));
+    for (int i = 0; i < W::kWidth; ++i)
+      if (m[i])
+        slackx[y + i] = x;
+  }
+#endif
+  for (; y < end; ++y) {
+    Cost s = lx + ly[y] - row[y];
+    if (slack[y] != inf && s < slack[y]) {
+      slack[y] = s;
+      slackx[y] = x;
     }
   }
+}
+
+// Returns the smallest slack of columns [y, end) outside of T.
+template <typename Cost>
+inline Cost MinSlack(const Cost *slack, int y, int end) {
+  Cost delta = CostTraits<Cost>::Infinity();
+#ifdef COLONY_SIMD
+  typedef Vec<Cost> W;
+  if (y + W::kWidth <= end) {
+    auto m = W::Load(slack + y);
+    for (y += W::kWidth; y + W::kWidth <= end; y += W::kWidth)
+      m = W::Min(m, W::Load(slack + y));
+    for (int i = 0; i < W::kWidth; ++i)
+      delta = std::min(delta, m[i]);
+  }
+#endif
+  for (; y < end; ++y)
+    delta = std::min(delta, slack[y]);
+  return delta;
+}
 
-  int max_match;         // n workers and n jobs
-  double lx[NX], ly[NY]; // labels of X and Y parts
-  int xy[NX];            // xy[x] - vertex that is matched with x,
-  int yx[NY];            // yx[y] - vertex that is matched with y
-  bool S[NX], T[NY];     // sets S and T in algorithm
-  double slack[NY];      // as in the algorithm description
-  int slackx[NY];        // slackx[y] such a vertex, that
-  // l(slackx[y]) + l(y) - w(slackx[y],y) = slack[y]
-  int prev[NX]; // array for memorizing alternating paths
+// Raises the labels of columns [y, end) in T by `delta` & lowers the slacks of
+// the other columns by the same amount.
+template <typename Cost>
+inline void ShiftColumns(Cost *ly, Cost *slack, Cost delta, int y, int end) {
+  const Cost inf = CostTraits<Cost>::Infinity();
+#ifdef COLONY_SIMD
+  typedef Vec<Cost> W;
+  for (; y + W::kWidth <= end; y += W::kWidth) {
+    auto old = W::Load(slack + y);
+    auto t = (typename W::M)(old == W::Splat(inf));
+    auto shift = W::Select(t, W::Splat(delta), W::Splat(0));
+    W::Store(ly + y, W::Load(ly + y) + shift);
+    W::Store(slack + y, W::Select(t, old, old - W::Splat(delta)));
+  }
+#endif
+  for (; y < end; ++y) {
+    if (slack[y] == inf)
+      ly[y] += delta;
+    else
+      slack[y] -= delta;
+  }
+}
+
+// Improves the matching until all X vertices are matched using the Hungarian
+// algorithm. Expects `NX <= NY` and the invariants listed in `RepairDense`.
+//
+// Slacks of the rows added to S are updated lazily - right before the labels
+// are improved. Columns that become tight through these rows are found by the
+// BFS instead. This batches the passes over the columns so that they can be
+// split into jobs (see `BasicWorkspace::executor`).
+template <typename Cost>
+inline void AugmentDense(BasicWorkspace<Cost> &ws, int NX, int NY) {
+  COLONY_PHASE(ws, kAugmentDense);
+  const Cost *value = ws.value.data();
+  Cost *lx = ws.lx.data(), *ly = ws.ly.data();
+  int *xy = ws.xy.data(), *yx = ws.yx.data();
+  char *S = ws.S.data();
+  Cost *slack = ws.slack.data(); // infinite for columns in T
+  int *slackx = ws.slackx.data();
+  int *prev = ws.prev.data();
+  int *q = ws.q.data(); // queue for bfs - it also holds all vertices of S
+  auto &pending = ws.pending;
+  const Cost in_T = CostTraits<Cost>::Infinity();
+
+  // Passes over the columns are split into `num_jobs` ranges of columns.
+  int num_jobs = 1;
+  if (ws.executor && ws.columns_per_job > 0)
+    num_jobs = std::max(1, NY / ws.columns_per_job);
+  ws.hits.resize(num_jobs);
+  ws.job_min.resize(num_jobs);
+  ws.job_next.resize(num_jobs);
+  auto for_columns = [&](auto &&job) { // job(j, begin, end)
+    if (num_jobs == 1) {
+      job(0, 0, NY);
+      return;
+    }
+    ws.executor(num_jobs, [&](int j) {
+      job(j, (int)((int64_t)NY * j / num_jobs),
+          (int)((int64_t)NY * (j + 1) / num_jobs));
+    });
+  };
+
+  int max_match = 0; // number of vertices in current matching
+  for (int x = 0; x < NX; x++)
+    if (xy[x] != -1)
+      max_match++;
+
+  // Labels stay feasible & matched edges stay tight at every step so the solve
+  // can stop anywhere. The next warm start continues from the partial matching.
+  // At least one path is augmented per call so that repeated calls finish.
+  ws.warm = true;
+  ws.optimal = true;
+  int augmented = 0;
+  auto expired = [&]() {
+    if (augmented == 0 || !Expired(ws))
+      return false;
+    ws.optimal = false;
+    return true;
+  };
 
+  int wr, rd; // wr,rd - write and read pos in queue
+
+  // Updates the slacks of the `pending` rows & improves the labeling. Columns
+  // that join the equality graph are left in `ws.hits`.
   auto update_labels = [&]() {
-    int x, y;
-    double delta = std::numeric_limits<double>::max();
-    for (y = 0; y < NY; y++) // calculate delta using slack
-      if (!T[y])
-        delta = std::min(delta, slack[y]);
-    for (x = 0; x < NX; x++) // update X labels
-      if (S[x])
-        lx[x] -= delta;
-    for (y = 0; y < NY; y++) // update Y labels
-      if (T[y])
-        ly[y] += delta;
-    for (y = 0; y < NY; y++) // update slack array
-      if (!T[y])
-        slack[y] -= delta;
+    COLONY_PHASE(ws, kUpdateLabels);
+    COLONY_STAT(ws, label_updates, 1);
+    COLONY_STAT(ws, column_visits, (int64_t)NY * (pending.size() + 3));
+    COLONY_STAT(ws, bytes, (int64_t)NY * (sizeof(Cost) * 4 +
+                                          pending.size() * (sizeof(Cost) * 3 +
+                                                            sizeof(int))));
+    for_columns([&](int j, int begin, int end) {
+      for (int x : pending)
+        UpdateSlack(value + (size_t)x * NY, lx[x], ly, slack, slackx, x, begin,
+                    end);
+      ws.job_min[j] = MinSlack(slack, begin, end); // calculate delta
+    });
+    pending.clear();
+    Cost delta = *std::min_element(ws.job_min.begin(), ws.job_min.end());
+    for (int i = 0; i < wr; i++) // update X labels
+      lx[q[i]] -= delta;
+    for_columns([&](int j, int begin, int end) {
+      ShiftColumns(ly, slack, delta, begin, end); // update Y labels & slack
+      auto &hits = ws.hits[j];
+      hits.clear();
+      for (int y = NextZeroSlack(slack, begin, end); y < end;
+           y = NextZeroSlack(slack, y + 1, end))
+        hits.emplace_back(-1, y);
+    });
   };
 
   // x - current vertex,prevx - vertex from X before x in the alternating
@@ -264,39 +1283,20 @@ inline void Optimize(std::vector<Assignment> &assignments) {
   auto add_to_tree = [&](int x, int prevx) {
     S[x] = true;     // add x to S
     prev[x] = prevx; // we need this when augmenting
-    for (int y = 0; y < NY;
-         y++) // update slacks, because we add new vertex to S
-      if (lx[x] + ly[y] - value[x][y] < slack[y]) {
-        slack[y] = lx[x] + ly[y] - value[x][y];
-        slackx[y] = x;
-      }
+    q[wr++] = x;
+    pending.push_back(x); // update slacks, because we add new vertex to S
+    COLONY_STAT(ws, bfs_vertices, 1);
   };
 
-  max_match = 0; // number of vertices in current matching
-  memset(xy, -1, sizeof(xy));
-  memset(yx, -1, sizeof(yx));
-
-  memset(lx, 0.0, sizeof(lx));
-  memset(ly, 0.0, sizeof(ly));
-  for (int x = 0; x < NX; x++)
-    for (int y = 0; y < NY; y++)
-      lx[x] = std::max(lx[x], value[x][y]);
-
-  auto eq = [](double a, double b) { return std::abs(a - b) < 0.0001; };
-
-  while (max_match < std::min(NX, NY)) {
-    int x, y, root; // just counters and root vertex
-    int q[NX], wr = 0,
-               rd = 0; // q - queue for bfs, wr,rd - write and read pos in queue
-    memset(S, false, sizeof(S)); // init set S
-    memset(T, false, sizeof(T)); // init set T
+  while (max_match < NX && !expired()) {
+    int x, y = NY, root = -1; // just counters and root vertex
+    wr = rd = 0;
+    memset(S, false, NX); // init set S
     memset(prev, -1,
-           sizeof(prev)); // init set prev - for the alternating tree
-    double best_lx = std::numeric_limits<double>::min();
+           sizeof(int) * NX); // init set prev - for the alternating tree
     for (x = 0; x < NX; x++) // finding root of the tree
       if (xy[x] == -1) {
-        if (lx[x] > best_lx) {
-          best_lx = lx[x];
+        if (root == -1 || lx[x] > lx[root]) {
           root = x;
         }
       }
@@ -304,62 +1304,98 @@ inline void Optimize(std::vector<Assignment> &assignments) {
     q[wr++] = root;
     prev[root] = -2;
     S[root] = true;
+    pending.clear();
 
-    for (y = 0; y < NY; y++) { // initializing slack array
-      slack[y] = lx[root] + ly[y] - value[root][y];
-      slackx[y] = root;
-    }
-
-    while (true) {               // main cycle
-      while (rd < wr) {          // building tree with bfs cycle
-        x = q[rd++];             // current vertex from X part
-        for (y = 0; y < NY; y++) // iterate through all edges in equality
-                                 // graph
-          if (eq(value[x][y], lx[x] + ly[y]) && !T[y]) {
-            if (yx[y] == -1)
-              break;         // an exposed vertex in Y found, so augmenting path
-                             // exists!
-            T[y] = true;     // else just add y to T,
-            q[wr++] = yx[y]; // add vertex yx[y], which is matched with y, to
-                             // the queue
-            add_to_tree(yx[y],
-                        x); // add edges (x,y) and (y,yx[y]) to the tree
+    const Cost *root_row = value + (size_t)root * NY;
+    COLONY_STAT(ws, bfs_vertices, 1);
+    COLONY_STAT(ws, column_visits, NY);
+    COLONY_STAT(ws, bytes, (int64_t)NY * (sizeof(Cost) * 3 + sizeof(int)));
+    for_columns([&](int, int begin, int end) {
+      for (int y = begin; y < end; y++) { // initializing slack array (& T)
+        slack[y] = lx[root] + ly[y] - root_row[y];
+        slackx[y] = root;
+      }
+    });
+
+    while (true) {      // main cycle
+      while (rd < wr) { // building tree with bfs cycle
+        // Rows [first, last) of the queue look for the edges in the equality
+        // graph in parallel. Each job adds the columns it finds to T.
+        int first = rd, last = wr;
+        rd = wr;
+        COLONY_STAT(ws, column_visits, (int64_t)(last - first) * NY);
+        COLONY_STAT(ws, bytes,
+                    (int64_t)(last - first) * NY * sizeof(Cost) * 3);
+        for_columns([&](int j, int begin, int end) {
+          auto &hits = ws.hits[j];
+          hits.clear();
+          for (int i = first; i < last; ++i) {
+            int x = q[i]; // current vertex from X part
+            const Cost *row = value + (size_t)x * NY;
+            for (int y = NextTight(row, lx[x], ly, slack, begin, end); y < end;
+                 y = NextTight(row, lx[x], ly, slack, y + 1, end)) {
+              slack[y] = in_T; // add y to T
+              hits.emplace_back(i, y);
+            }
+          }
+        });
+        // Go through the edges in the order of the serial scan.
+        std::fill(ws.job_next.begin(), ws.job_next.end(), 0);
+        for (int i = first; i < last && y == NY; ++i) {
+          for (int j = 0; j < num_jobs && y == NY; ++j) {
+            auto &hits = ws.hits[j];
+            for (int &k = ws.job_next[j];
+                 k < (int)hits.size() && hits[k].first == i;
+                 ++k) {
+              int hit = hits[k].second;
+              if (yx[hit] == -1) { // an exposed vertex in Y found, so
+                x = q[i];          // augmenting path exists!
+                y = hit;
+                break;
+              }
+              add_to_tree(yx[hit], q[i]); // add edges (x,y) and (y,yx[y]) to
+                                          // the tree
+            }
           }
+        }
         if (y < NY)
           break; // augmenting path found!
       }
       if (y < NY)
         break; // augmenting path found!
 
+      if (expired())
+        return;
       update_labels(); // augmenting path not found, so improve labeling
-      wr = rd = 0;
-      for (y = 0; y < NY; y++)
-        // in this cycle we add edges that were added to the equality graph as
-        // a result of improving the labeling, we add edge (slackx[y], y) to
-        // the tree if and only if !T[y] && slack[y] == 0, also with this edge
-        // we add another one (y, yx[y]) or augment the matching, if y was
-        // exposed
-        if (!T[y] && eq(slack[y], 0)) {
-          if (yx[y] ==
-              -1) { // exposed vertex in Y found - augmenting path exists!
-            x = slackx[y];
+      // in this cycle we add edges that were added to the equality graph as
+      // a result of improving the labeling, we add edge (slackx[y], y) to
+      // the tree if and only if !T[y] && slack[y] == 0, also with this edge
+      // we add another one (y, yx[y]) or augment the matching, if y was
+      // exposed
+      for (int j = 0; j < num_jobs && y == NY; ++j) {
+        for (auto &hit : ws.hits[j]) {
+          if (yx[hit.second] == -1) { // exposed vertex in Y found - augmenting
+                                      // path exists!
+            x = slackx[hit.second];
+            y = hit.second;
             break;
-          } else {
-            T[y] = true; // else just add y to T,
-            if (!S[yx[y]]) {
-              q[wr++] = yx[y]; // add vertex yx[y], which is matched with
-              // y, to the queue
-              add_to_tree(yx[y], slackx[y]); // and add edges (x,y) and (y,
-              // yx[y]) to the tree
-            }
+          }
+          slack[hit.second] = in_T; // else just add y to T,
+          if (!S[yx[hit.second]]) {
+            // add vertex yx[y], which is matched with y, to the queue & add
+            // edges (x,y) and (y, yx[y]) to the tree
+            add_to_tree(yx[hit.second], slackx[hit.second]);
           }
         }
+      }
       if (y < NY)
         break; // augmenting path found!
     }
 
     if (y < NY) {  // we found augmenting path!
       max_match++; // increment matching
+      augmented++;
+      COLONY_STAT(ws, augmentations, 1);
       // in this cycle we inverse edges along augmenting path
       for (int cx = x, cy = y, ty; cx != -2; cx = prev[cx], cy = ty) {
         ty = xy[cx];
@@ -368,25 +1404,3420 @@ inline void Optimize(std::vector<Assignment> &assignments) {
       }
     }
   }
+}
 
-  if (max_task > max_character) {
-    for (int i = 0; i < assignments.size(); ++i) {
-      if (assignments[i].task != xy[assignments[i].character]) {
-        std::swap(assignments[i], assignments.back());
-        assignments.pop_back();
-        --i;
-      }
-    }
+// Finds the max-value matching of all X vertices using the Hungarian
+// algorithm. Expects `NX <= NY` and `ws.value` to be filled.
+template <typename Cost>
+inline void SolveDense(BasicWorkspace<Cost> &ws, int NX, int NY) {
+  ResetDense(ws, NX, NY);
+  AugmentDense(ws, NX, NY);
+}
+
+// Finds the max-value matching of all X vertices in `ws.value`. Starts from
+// the previous solution if it exists & is `compatible` with the new problem
+// (X & Y vertices have the same meaning) & the workspace isn't
+// `deterministic`. `ws.prev_value` must hold the previous value matrix.
+template <typename Cost>
+inline void ResolveDense(BasicWorkspace<Cost> &ws, int NX, int NY, int old_NX,
+                         int old_NY, bool compatible) {
+  if (ws.warm && compatible && !ws.deterministic) {
+    RepairDense(ws, NX, NY, old_NX, old_NY);
+    AugmentDense(ws, NX, NY);
   } else {
-    for (int i = 0; i < assignments.size(); ++i) {
-      if (assignments[i].task != yx[assignments[i].character]) {
-        std::swap(assignments[i], assignments.back());
-        assignments.pop_back();
-        --i;
-      }
-    }
-    
+    SolveDense(ws, NX, NY);
   }
 }
 
+// Completes the matching of a solve that ran out of time. The partial matching
+// may hold missing pairs (tight edges of the solver) so the X vertices that are
+// exposed or matched only by a missing pair first take the free (likewise) Y
+// vertex with the best value, as long as it's a real pair. Their old partners
+// are matched with each other & may look again. Remaining exposed X vertices
+// take the best exposed Y vertex. No pair whose character & task are both
+// unassigned is left out. Each step adds a real pair so it costs O(NX * NY) at
+// worst. Undo with `UndoGreedy`.
+template <typename Cost>
+inline void CompleteGreedy(BasicWorkspace<Cost> &ws, int NX, int NY) {
+  const Cost *value = ws.value.data();
+  const Cost missing = -ws.max_cost;
+  int *xy = ws.xy.data(), *yx = ws.yx.data();
+  ws.greedy_xy.assign(ws.xy.begin(), ws.xy.begin() + NX);
+  auto free = [&](int x, int y) {
+    return y == -1 || x == -1 || !(value[(size_t)x * NY + y] > missing);
+  };
+  auto &queue = ws.greedy_x;
+  queue.clear();
+  for (int x = NX - 1; x >= 0; --x)
+    if (free(x, xy[x]))
+      queue.push_back(x);
+  while (!queue.empty()) {
+    int x = queue.back();
+    queue.pop_back();
+    if (!free(x, xy[x]))
+      continue;
+    const Cost *row = value + (size_t)x * NY;
+    int best = -1;
+    for (int y = 0; y < NY; ++y)
+      if (row[y] > missing && free(yx[y], y) &&
+          (best == -1 || row[y] > row[best]))
+        best = y;
+    if (best == -1)
+      continue;
+    int old_y = xy[x], old_x = yx[best];
+    xy[x] = best;
+    yx[best] = x;
+    if (old_x != -1) {
+      xy[old_x] = old_y;
+    }
+    if (old_y != -1) {
+      yx[old_y] = old_x;
+    }
+    if (old_x != -1 && free(old_x, old_y))
+      queue.push_back(old_x);
+  }
+  for (int x = 0; x < NX; ++x) {
+    if (xy[x] != -1)
+      continue;
+    const Cost *row = value + (size_t)x * NY;
+    int best = -1;
+    for (int y = 0; y < NY; ++y)
+      if (yx[y] == -1 && (best == -1 || row[y] > row[best]))
+        best = y;
+    xy[x] = best;
+    yx[best] = x;
+  }
+}
+
+// Takes back the pairs of `CompleteGreedy` so that the next warm start sees
+// the partial matching of the solver.
+template <typename Cost> inline void UndoGreedy(BasicWorkspace<Cost> &ws) {
+  int NX = ws.greedy_xy.size();
+  std::fill(ws.yx.begin(), ws.yx.begin() + ws.NY, -1);
+  for (int x = 0; x < NX; ++x) {
+    ws.xy[x] = ws.greedy_xy[x];
+    if (ws.xy[x] != -1)
+      ws.yx[ws.xy[x]] = x;
+  }
+}
+
+// Writes out the dense matching with `emit()`. When the solve ran out of time
+// the matching is completed greedily just for the output.
+template <typename Cost, typename Emit>
+inline auto EmitMatching(BasicWorkspace<Cost> &ws, Emit &&emit) {
+  if (ws.optimal)
+    return emit();
+  CompleteGreedy(ws, ws.NX, ws.NY);
+  auto result = emit();
+  UndoGreedy(ws);
+  return result;
+}
+
+// Prepares the lookup of `FindIncumbent` for the assignments in `previous`.
+template <typename Cost>
+inline void SetIncumbents(std::span<const BasicAssignment<Cost>> previous,
+                          BasicWorkspace<Cost> &ws) {
+  auto &incumbents = ws.incumbents;
+  incumbents.assign(previous.begin(), previous.end());
+  std::stable_sort(incumbents.begin(), incumbents.end(),
+                   [](auto &a, auto &b) { return a.character < b.character; });
+  ws.incumbent_cost.assign(incumbents.size(), CostTraits<Cost>::Infinity());
+  CharacterId min_character = 0, max_character = -1;
+  for (auto &a : incumbents) {
+    min_character = std::min(min_character, a.character);
+    max_character = std::max(max_character, a.character);
+  }
+  ws.incumbents_sparse = min_character < 0 ||
+                         max_character >= 4 * (int64_t)incumbents.size() + 1024;
+  if (!ws.incumbents_sparse) {
+    ws.incumbent_slot.assign(max_character + 1, -1);
+    for (int i = (int)incumbents.size() - 1; i >= 0; --i)
+      ws.incumbent_slot[incumbents[i].character] = i;
+  }
+}
+
+// Index of the (character, task) pair in `ws.incumbents` or -1.
+template <typename Cost>
+inline int FindIncumbent(const BasicWorkspace<Cost> &ws, CharacterId character,
+                         TaskId task) {
+  const auto &incumbents = ws.incumbents;
+  int i;
+  if (ws.incumbents_sparse) {
+    auto it = std::lower_bound(
+        incumbents.begin(), incumbents.end(), character,
+        [](auto &a, CharacterId c) { return a.character < c; });
+    if (it == incumbents.end() || it->character != character)
+      return -1;
+    i = it - incumbents.begin();
+  } else {
+    if (character < 0 || character >= (int)ws.incumbent_slot.size())
+      return -1;
+    i = ws.incumbent_slot[character];
+    if (i == -1)
+      return -1;
+  }
+  return incumbents[i].task == task ? i : -1;
+}
+
+// Makes the assignments that are also in `previous` cheaper by
+// `switching_penalty`. Undo with `RemoveIncumbentBonus`.
+template <typename Cost>
+inline void AddIncumbentBonus(std::span<BasicAssignment<Cost>> assignments,
+                              std::span<const BasicAssignment<Cost>> previous,
+                              Cost switching_penalty,
+                              BasicWorkspace<Cost> &ws) {
+  SetIncumbents(previous, ws);
+  for (auto &a : assignments) {
+    int i = FindIncumbent(ws, a.character, a.task);
+    if (i != -1 && a.cost < CostTraits<Cost>::Infinity()) {
+      ws.incumbent_cost[i] = std::min(ws.incumbent_cost[i], a.cost);
+      a.cost -= switching_penalty;
+    }
+  }
+}
+
+// Restores the costs changed by `AddIncumbentBonus`.
+template <typename Cost>
+inline void RemoveIncumbentBonus(std::span<BasicAssignment<Cost>> assignments,
+                                 const BasicWorkspace<Cost> &ws) {
+  for (auto &a : assignments) {
+    int i = FindIncumbent(ws, a.character, a.task);
+    if (i != -1 && ws.incumbent_cost[i] < CostTraits<Cost>::Infinity())
+      a.cost = ws.incumbent_cost[i];
+  }
+}
+
+// Whether `cost` belongs to a possible pair. Impossible pairs (marked with
+// `CostTraits<Cost>::Infinity()`) are skipped by the solvers - just like the
+// missing ones.
+template <typename Cost> inline bool IsPossible(Cost cost) {
+  return cost < CostTraits<Cost>::Infinity();
+}
+
+// Fills `ws.value` with the given assignments. Characters go into X and tasks
+// into Y unless there is more characters than tasks. Impossible pairs are
+// skipped.
+//
+// The value of an edge is its negated cost. Pairs that are missing are worth
+// as much as the most expensive assignment (or `unassigned_cost` if it's
+// bigger). Values don't depend on anything else so they stay the same across
+// frames when the costs don't change.
+template <typename Cost, typename Rows>
+inline void FillDense(const Rows &assignments, BasicWorkspace<Cost> &ws,
+                      int &NX, int &NY, bool &transpose,
+                      Cost unassigned_cost = 0) {
+  COLONY_PHASE(ws, kFillDense);
+  CharacterId max_character = 0;
+  TaskId max_task = 0;
+  Cost max_cost = unassigned_cost;
+  size_t n = assignments.size();
+  for (size_t i = 0; i < n; ++i) {
+    auto &&a = assignments[i];
+    max_character = std::max(max_character, a.character);
+    max_task = std::max(max_task, a.task);
+    if (IsPossible(a.cost)) {
+      max_cost = std::max(max_cost, a.cost);
+    }
+  }
+
+  // The algorithm finds the optimal assignment only when NX <= NY.
+  transpose = !(max_task > max_character);
+  if (!transpose) {
+    NX = max_character + 1;
+    NY = max_task + 1;
+  } else {
+    NX = max_task + 1;
+    NY = max_character + 1;
+  }
+
+  ws.max_cost = max_cost;
+  ws.value.assign((size_t)NX * NY, -max_cost);
+  Cost *value = ws.value.data();
+
+  // Duplicated pairs keep the cheapest cost. Impossible pairs would be
+  // cheaper than that so they're skipped.
+  if (!transpose) {
+    for (size_t i = 0; i < n; ++i) {
+      auto &&a = assignments[i];
+      Cost &v = value[(size_t)a.character * NY + a.task];
+      if (IsPossible(a.cost))
+        v = std::max(v, -a.cost);
+    }
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      auto &&a = assignments[i];
+      Cost &v = value[(size_t)a.task * NY + a.character];
+      if (IsPossible(a.cost))
+        v = std::max(v, -a.cost);
+    }
+  }
+}
+
+// Fills `ws.value` with costs read from `cost(character, task)`. Characters
+// are [0, num_characters) and tasks are [0, num_tasks). Infinite costs mark
+// the missing pairs. Otherwise works just like the `FillDense` above.
+template <typename Cost, typename CostFn>
+inline void FillDense(int num_characters, int num_tasks, CostFn &cost,
+                      BasicWorkspace<Cost> &ws, int &NX, int &NY,
+                      bool &transpose) {
+  COLONY_PHASE(ws, kFillDense);
+  transpose = !(num_tasks > num_characters);
+  NX = transpose ? num_tasks : num_characters;
+  NY = transpose ? num_characters : num_tasks;
+  ws.value.resize((size_t)NX * NY);
+  Cost *value = ws.value.data();
+  const Cost missing = -CostTraits<Cost>::Infinity();
+  Cost max_cost = 0;
+  for (int x = 0; x < NX; ++x) {
+    Cost *row = value + (size_t)x * NY;
+    for (int y = 0; y < NY; ++y) {
+      Cost c = transpose ? cost(y, x) : cost(x, y);
+      if (c < CostTraits<Cost>::Infinity()) {
+        row[y] = -c;
+        max_cost = std::max(max_cost, c);
+      } else {
+        row[y] = missing;
+      }
+    }
+  }
+  for (size_t i = 0; i < (size_t)NX * NY; ++i) {
+    if (value[i] == missing) {
+      value[i] = -max_cost;
+    }
+  }
+  ws.max_cost = max_cost;
+}
+
+// Writes the pairs from the dense matching into `assignments`. Missing pairs
+// (with infinite cost) are skipped.
+template <typename Cost, typename CostFn>
+inline void EmitDense(CostFn &cost, const BasicWorkspace<Cost> &ws,
+                      std::vector<BasicAssignment<Cost>> &assignments) {
+  COLONY_PHASE(ws, kEmitDense);
+  assignments.clear();
+  for (int x = 0; x < ws.NX; ++x) {
+    int y = ws.xy[x];
+    CharacterId character = ws.transpose ? y : x;
+    TaskId task = ws.transpose ? x : y;
+    Cost c = cost(character, task);
+    if (c < CostTraits<Cost>::Infinity()) {
+      assignments.push_back(BasicAssignment<Cost>{character, task, c});
+    }
+  }
+  if (ws.deterministic && ws.transpose) {
+    std::sort(assignments.begin(), assignments.end(),
+              [](auto &a, auto &b) { return a.character < b.character; });
+  }
+}
+
+// Whether character & task ids are too sparse to be used as indices. Like
+// the other internal functions that take `Rows`, works with spans & vectors of
+// assignments as well as with `BasicAssignmentColumns`.
+template <typename Cost, typename Rows>
+inline bool HasSparseIds(const Rows &assignments) {
+  CharacterId min_character = 0, max_character = 0;
+  TaskId min_task = 0, max_task = 0;
+  for (size_t i = 0; i < assignments.size(); ++i) {
+    auto &&a = assignments[i];
+    min_character = std::min(min_character, a.character);
+    max_character = std::max(max_character, a.character);
+    min_task = std::min(min_task, a.task);
+    max_task = std::max(max_task, a.task);
+  }
+  return min_character < 0 || min_task < 0 ||
+         (max_character + 1.0) * (max_task + 1.0) >
+             2.0 * assignments.size() + 1024;
+}
+
+// Registers all character & task ids in `ws.character_ids` & `ws.task_ids`.
+// Ids that are no longer present are removed from the maps. `deterministic`
+// workspaces start with empty maps so that the indices don't depend on the
+// earlier problems.
+template <typename Cost, typename Rows>
+inline void UpdateIds(const Rows &assignments, BasicWorkspace<Cost> &ws) {
+  if (ws.deterministic) {
+    ws.character_ids.Clear();
+    ws.task_ids.Clear();
+  }
+  auto update = [&](auto &ids, auto id_of) {
+    for (size_t i = 0; i < assignments.size(); ++i) {
+      ids.Insert(id_of(assignments[i]));
+    }
+    ws.seen.assign(ids.Capacity(), false);
+    for (size_t i = 0; i < assignments.size(); ++i) {
+      ws.seen[ids.Find(id_of(assignments[i]))] = true;
+    }
+    for (int i = 0; i < ids.Capacity(); ++i) {
+      if (!ws.seen[i] && ids.IsLive(i)) {
+        ids.Remove(ids[i]);
+      }
+    }
+  };
+  using A = BasicAssignment<Cost>;
+  update(ws.character_ids, [](const A &a) { return a.character; });
+  update(ws.task_ids, [](const A &a) { return a.task; });
+}
+
+// Replaces sparse character & task ids with dense indices from
+// `ws.character_ids` & `ws.task_ids`. Returns false (and leaves the
+// assignments alone) when the ids are dense enough to be used directly.
+template <typename Cost>
+inline bool CompactIds(std::span<BasicAssignment<Cost>> assignments,
+                       BasicWorkspace<Cost> &ws) {
+  COLONY_PHASE(ws, kCompactIds);
+  if (!HasSparseIds<Cost>(assignments)) {
+    return false;
+  }
+  UpdateIds<Cost>(assignments, ws);
+  for (auto &a : assignments) {
+    a.character = ws.character_ids.Find(a.character);
+    a.task = ws.task_ids.Find(a.task);
+  }
+  return true;
+}
+
+// Reverts `CompactIds`.
+template <typename Cost>
+inline void RestoreIds(std::span<BasicAssignment<Cost>> assignments,
+                       const BasicWorkspace<Cost> &ws) {
+  for (auto &a : assignments) {
+    a.character = ws.character_ids[a.character];
+    a.task = ws.task_ids[a.task];
+  }
+}
+
+// Order used to pick the cheapest assignments. Ties are broken by ids so that
+// the result doesn't depend on the order of the input.
+template <typename Cost>
+inline bool Cheaper(const BasicAssignment<Cost> &a,
+                    const BasicAssignment<Cost> &b) {
+  if (a.cost != b.cost)
+    return a.cost < b.cost;
+  if (a.character != b.character)
+    return a.character < b.character;
+  return a.task < b.task;
+}
+
+// Order of the potential assignments & of the results in the `deterministic`
+// mode.
+template <typename Cost>
+inline bool ById(const BasicAssignment<Cost> &a,
+                 const BasicAssignment<Cost> &b) {
+  if (a.character != b.character)
+    return a.character < b.character;
+  if (a.task != b.task)
+    return a.task < b.task;
+  return a.cost < b.cost;
+}
+
+// Sorts the assignments with `ById` & drops the duplicated pairs (keeping the
+// cheapest one) so that the solvers see the same problem no matter the order
+// of the input. Returns the number of assignments left.
+template <typename Cost>
+inline int Canonicalize(std::span<BasicAssignment<Cost>> assignments) {
+  std::sort(assignments.begin(), assignments.end(), ById<Cost>);
+  auto end = std::unique(assignments.begin(), assignments.end(),
+                         [](auto &a, auto &b) {
+                           return a.character == b.character &&
+                                  a.task == b.task;
+                         });
+  return end - assignments.begin();
+}
+
+// Keeps at most `limit` cheapest assignments of `input` with each key & puts
+// them in `assignments` (which may be the same as `input`). Keys must be in
+// the range [0, num_keys). Kept assignments are grouped by key & sorted by
+// `Cheaper` within each group. Runs in O(n + num_keys).
+template <typename Cost, typename Rows, typename Key>
+inline void KeepCheapest(const Rows &input,
+                         std::vector<BasicAssignment<Cost>> &assignments,
+                         int num_keys, Key key, int limit,
+                         BasicWorkspace<Cost> &ws) {
+  size_t n = input.size();
+  limit = std::max(limit, 0);
+  auto &grouped = ws.scratch;
+  auto &start = ws.group_start;
+  auto &size = ws.group_size;
+  if ((size_t)num_keys * limit <= n) {
+    // Few assignments will be kept - collect them in bounded max-heaps.
+    grouped.resize((size_t)num_keys * limit);
+    size.assign(num_keys, 0);
+    for (size_t i = 0; i < n; ++i) {
+      BasicAssignment<Cost> a = input[i];
+      int k = key(a);
+      auto heap = grouped.begin() + (size_t)k * limit;
+      if (size[k] < limit) {
+        heap[size[k]++] = a;
+        std::push_heap(heap, heap + size[k], Cheaper<Cost>);
+      } else if (limit > 0 && Cheaper(a, heap[0])) {
+        std::pop_heap(heap, heap + limit, Cheaper<Cost>);
+        heap[limit - 1] = a;
+        std::push_heap(heap, heap + limit, Cheaper<Cost>);
+      }
+    }
+    assignments.clear();
+    for (int k = 0; k < num_keys; ++k) {
+      auto heap = grouped.begin() + (size_t)k * limit;
+      std::sort_heap(heap, heap + size[k], Cheaper<Cost>);
+      assignments.insert(assignments.end(), heap, heap + size[k]);
+    }
+    return;
+  }
+  // Many assignments will be kept - group them with counting sort & select
+  // the cheapest ones in each group.
+  start.assign(num_keys + 1, 0);
+  for (size_t i = 0; i < n; ++i)
+    ++start[key(input[i]) + 1];
+  for (int k = 0; k < num_keys; ++k)
+    start[k + 1] += start[k];
+  grouped.resize(n);
+  size.assign(num_keys, 0);
+  for (size_t i = 0; i < n; ++i) {
+    BasicAssignment<Cost> a = input[i];
+    int k = key(a);
+    grouped[start[k] + size[k]++] = a;
+  }
+  assignments.clear();
+  for (int k = 0; k < num_keys; ++k) {
+    auto begin = grouped.begin() + start[k];
+    auto end = grouped.begin() + start[k + 1];
+    if (end - begin > limit) {
+      std::nth_element(begin, begin + limit, end, Cheaper<Cost>);
+      end = begin + limit;
+    }
+    std::sort(begin, end, Cheaper<Cost>);
+    assignments.insert(assignments.end(), begin, end);
+  }
+}
+
+// Whether the potential assignment of X vertex `x` to `y` is the pair of the
+// dense matching. Only the first copy of a duplicated pair with the cheapest
+// cost is - `ws.S` marks the X vertices that were already emitted. Impossible
+// pairs never are.
+template <typename Cost>
+inline bool IsMatched(BasicWorkspace<Cost> &ws, int x, int y, Cost cost) {
+  if (ws.xy[x] != y || ws.S[x] || !IsPossible(cost) ||
+      ws.value[(size_t)x * ws.NY + y] != -cost)
+    return false;
+  ws.S[x] = true;
+  return true;
+}
+
+// Moves the assignments that are part of the dense matching to the beginning
+// of `assignments`. Returns their number.
+template <typename Cost>
+inline int FilterDense(std::span<BasicAssignment<Cost>> assignments,
+                       BasicWorkspace<Cost> &ws) {
+  COLONY_PHASE(ws, kFilterDense);
+  std::fill(ws.S.begin(), ws.S.end(), false);
+  int n = assignments.size();
+  for (int i = 0; i < n; ++i) {
+    auto &a = assignments[i];
+    int x = ws.transpose ? a.task : a.character;
+    int y = ws.transpose ? a.character : a.task;
+    if (!IsMatched(ws, x, y, a.cost)) {
+      std::swap(assignments[i], assignments[--n]);
+      --i;
+    }
+  }
+  return n;
+}
+
+// Appends the rows of `assignments` that are part of the dense matching to
+// `output`. Only the id columns are read for the other rows.
+template <typename Cost>
+inline void EmitColumns(const BasicAssignmentColumns<Cost> &assignments,
+                        BasicWorkspace<Cost> &ws,
+                        BasicAssignmentBuffer<Cost> &output) {
+  COLONY_PHASE(ws, kFilterDense);
+  std::fill(ws.S.begin(), ws.S.end(), false);
+  const int *xy = ws.xy.data();
+  const uint32_t *x_ids = ws.transpose ? assignments.tasks.data()
+                                       : assignments.characters.data();
+  const uint32_t *y_ids = ws.transpose ? assignments.characters.data()
+                                       : assignments.tasks.data();
+  size_t n = assignments.size();
+  for (size_t i = 0; i < n; ++i) {
+    if (xy[x_ids[i]] == (int)y_ids[i] &&
+        IsMatched(ws, x_ids[i], y_ids[i], assignments.costs[i])) {
+      output.push_back(assignments[i]);
+    }
+  }
+}
+
+template <typename Cost, typename Rows, typename Emit>
+inline int SolveComponents(const Rows &assignments, BasicWorkspace<Cost> &ws,
+                           Cost unassigned_cost, Emit &&emit);
+
+// Core of `Optimize`. Moves the optimal assignments to the beginning of
+// `assignments` & returns their number. Missing pairs are worth at least
+// `unassigned_cost`. When `split` is set, connected components are solved
+// separately.
+template <typename Cost>
+inline int OptimizeInPlace(std::span<BasicAssignment<Cost>> assignments,
+                           BasicWorkspace<Cost> &ws, Cost unassigned_cost = 0,
+                           bool split = true) {
+  if (ws.deterministic) {
+    // Dropped copies of the duplicated pairs still count towards the most
+    // expensive assignment - just like in the other modes.
+    for (auto &a : assignments) {
+      if (IsPossible(a.cost)) {
+        unassigned_cost = std::max(unassigned_cost, a.cost);
+      }
+    }
+    assignments = assignments.first(Canonicalize(assignments));
+  }
+  ws.compact = CompactIds(assignments, ws);
+  int n = -1;
+  if (split && ws.split_components) {
+    n = SolveComponents(
+        assignments, ws, unassigned_cost,
+        [&](int i, const BasicAssignment<Cost> &a) { assignments[i] = a; });
+  }
+  if (n == -1) {
+    int NX, NY;
+    FillDense<Cost>(assignments, ws, NX, NY, ws.transpose, unassigned_cost);
+    SolveDense(ws, NX, NY);
+    n = EmitMatching(ws, [&] { return FilterDense(assignments, ws); });
+  } else {
+    ws.warm = false; // the dense solver didn't see this problem
+  }
+  if (ws.compact) {
+    RestoreIds(assignments.first(n), ws);
+  }
+  if (ws.deterministic) {
+    std::sort(assignments.begin(), assignments.begin() + n, ById<Cost>);
+  }
+  return n;
+}
+
+// Core of the `Optimize` that takes columns. Writes the optimal assignments to
+// `output`. Problems with sparse ids are copied to rows & compacted.
+template <typename Cost>
+inline void OptimizeColumns(const BasicAssignmentColumns<Cost> &assignments,
+                            BasicAssignmentBuffer<Cost> &output,
+                            BasicWorkspace<Cost> &ws) {
+  output.clear();
+  if (HasSparseIds<Cost>(assignments)) {
+    auto &rows = ws.rows;
+    rows.resize(assignments.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+      rows[i] = assignments[i];
+    }
+    int n = OptimizeInPlace<Cost>(rows, ws);
+    output.reserve(n);
+    for (int i = 0; i < n; ++i) {
+      output.push_back(rows[i]);
+    }
+    return;
+  }
+  ws.compact = false;
+  int n = -1;
+  if (ws.split_components) {
+    n = SolveComponents(
+        assignments, ws, Cost(0),
+        [&](int, const BasicAssignment<Cost> &a) { output.push_back(a); });
+  }
+  if (n == -1) {
+    int NX, NY;
+    FillDense<Cost>(assignments, ws, NX, NY, ws.transpose);
+    SolveDense(ws, NX, NY);
+    EmitMatching(ws, [&] {
+      EmitColumns(assignments, ws, output);
+      return 0;
+    });
+  } else {
+    ws.warm = false; // the dense solver didn't see this problem
+  }
+  if (ws.deterministic) { // same order as the rows from `OptimizeInPlace`
+    auto &rows = ws.rows;
+    rows.resize(output.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+      rows[i] = output[i];
+    }
+    std::sort(rows.begin(), rows.end(), ById<Cost>);
+    output.clear();
+    for (auto &a : rows) {
+      output.push_back(a);
+    }
+  }
+}
+
+// Fills the CSR edge arrays of `ws` with the given assignments. X vertices
+// are tasks when `transpose` is set & characters otherwise. Impossible pairs
+// get no edges.
+template <typename Cost>
+inline void FillEdges(std::span<const BasicAssignment<Cost>> assignments,
+                      BasicWorkspace<Cost> &ws, int NX, bool transpose) {
+  int n = assignments.size();
+  // Counting sort of the edges by their X vertex.
+  auto &row_start = ws.row_start;
+  row_start.assign(NX + 1, 0);
+  for (auto &a : assignments) {
+    if (IsPossible(a.cost)) {
+      ++row_start[(transpose ? a.task : a.character) + 1];
+    }
+  }
+  for (int x = 0; x < NX; ++x) {
+    row_start[x + 1] += row_start[x];
+  }
+  int E = row_start[NX];
+  ws.edge_x.resize(E);
+  ws.edge_y.resize(E);
+  ws.edge_cost.resize(E);
+  ws.edge_assignment.resize(E);
+  auto &fill = ws.slackx; // next free edge slot of each X vertex
+  fill.assign(row_start.begin(), row_start.end() - 1);
+  for (int i = 0; i < n; ++i) {
+    auto &a = assignments[i];
+    if (!IsPossible(a.cost)) {
+      continue;
+    }
+    int x = transpose ? a.task : a.character;
+    int e = fill[x]++;
+    ws.edge_x[e] = x;
+    ws.edge_y[e] = transpose ? a.character : a.task;
+    ws.edge_cost[e] = a.cost;
+    ws.edge_assignment[e] = i;
+  }
+}
+
+// Lists the edges of each Y vertex in `ws.column_edge`. Edges of y are
+// `column_edge[column_start[y]] ... column_edge[column_start[y + 1] - 1]`.
+// Reads the edges of `FillEdges` so the impossible pairs are already gone.
+template <typename Cost>
+inline void FillColumns(BasicWorkspace<Cost> &ws, int NY) {
+  int E = ws.edge_y.size();
+  auto &column_start = ws.column_start;
+  auto &column_edge = ws.column_edge;
+  column_start.assign(NY + 1, 0);
+  for (int e = 0; e < E; ++e)
+    ++column_start[ws.edge_y[e] + 1];
+  for (int y = 0; y < NY; ++y)
+    column_start[y + 1] += column_start[y];
+  column_edge.resize(E);
+  auto &fill = ws.slackx;
+  fill.assign(column_start.begin(), column_start.end() - 1);
+  for (int e = 0; e < E; ++e)
+    column_edge[fill[ws.edge_y[e]]++] = e;
+}
+
+// Finds the min-cost matching of all X vertices using successive shortest
+// paths. Every X vertex can also stay unassigned for `unassigned_cost`.
+// Expects the CSR edge arrays of `ws` to be filled.
+//
+// Each augmentation runs Dijkstra over reduced costs
+// `cost + px[x] - py[y]` and only touches the edges that it actually reaches.
+// Potential of the sink is always 0 so the unassigned option of vertex x has
+// the reduced cost of `unassigned_cost + px[x]`.
+template <typename Cost>
+inline void SolveSparse(BasicWorkspace<Cost> &ws, int NX, int NY,
+                        Cost unassigned_cost) {
+  COLONY_PHASE(ws, kSolveSparse);
+  ws.xe.assign(NX, -1);
+  ws.yx.assign(NY, -1);
+  ws.py.assign(NY, Cost(0));
+  ws.px.resize(NX);
+  ws.dist.resize(NY);
+  ws.ye.assign(NY, -1);
+  ws.T.assign(NY, false);
+
+  const int *row_start = ws.row_start.data();
+  const int *edge_x = ws.edge_x.data(), *edge_y = ws.edge_y.data();
+  const Cost *edge_cost = ws.edge_cost.data();
+  Cost *px = ws.px.data(), *py = ws.py.data();
+  int *xe = ws.xe.data(), *yx = ws.yx.data();
+  Cost *dist = ws.dist.data();
+  int *ye = ws.ye.data();
+  char *T = ws.T.data(); // T[y] - distance of y is final
+  auto &touched = ws.touched;
+  auto &heap = ws.heap;
+  auto &reached = ws.q; // X vertices reached from the root
+  const std::greater<std::pair<Cost, int>> heap_order;
+
+  // Make the reduced costs non-negative even if some costs are negative.
+  for (int x = 0; x < NX; ++x) {
+    px[x] = 0;
+    for (int e = row_start[x]; e < row_start[x + 1]; ++e)
+      px[x] = std::max(px[x], -edge_cost[e]);
+  }
+
+  for (int root = 0; root < NX; ++root) {
+    heap.clear();
+    touched.clear();
+    reached.clear();
+
+    // Best path to the sink found so far. It ends either in an exposed Y
+    // vertex (`sink_y`) or in the unassigned option of `sink_x`.
+    Cost best = unassigned_cost + px[root];
+    int sink_x = root, sink_y = -1;
+
+    auto relax = [&](int x, Cost dx) {
+      for (int e = row_start[x]; e < row_start[x + 1]; ++e) {
+        if (e == xe[x])
+          continue;
+        int y = edge_y[e];
+        if (T[y])
+          continue;
+        Cost d = dx + edge_cost[e] + px[x] - py[y];
+        if (ye[y] == -1) { // first visit
+          ye[y] = e;
+          dist[y] = d;
+          touched.push_back(y);
+        } else if (d < dist[y]) {
+          ye[y] = e;
+          dist[y] = d;
+        } else {
+          continue;
+        }
+        heap.emplace_back(d, y);
+        std::push_heap(heap.begin(), heap.end(), heap_order);
+      }
+    };
+
+    // `ye` of the untouched vertices is -1 so that `relax` can spot them.
+    reached.push_back(root);
+    relax(root, 0);
+    while (!heap.empty()) {
+      auto [d, y] = heap.front();
+      std::pop_heap(heap.begin(), heap.end(), heap_order);
+      heap.pop_back();
+      if (T[y] || d > dist[y])
+        continue; // stale entry
+      if (d >= best)
+        break; // nothing closer than the best path
+      T[y] = true;
+      int x = yx[y];
+      if (x == -1) { // an exposed vertex in Y - path to the sink
+        best = d + py[y];
+        sink_x = -1;
+        sink_y = y;
+        continue;
+      }
+      // The matched edge (x, y) has a reduced cost of 0.
+      reached.push_back(x);
+      if (d + unassigned_cost + px[x] < best) {
+        best = d + unassigned_cost + px[x];
+        sink_x = x;
+        sink_y = -1;
+      }
+      relax(x, d);
+    }
+
+    // Update the potentials so that reduced costs stay non-negative and the
+    // augmenting path consists of zero-cost edges.
+    for (int y : touched) {
+      if (T[y])
+        py[y] += dist[y] - best;
+      T[y] = false;
+    }
+    for (int x : reached) {
+      Cost dx = x == root ? 0 : dist[edge_y[xe[x]]];
+      px[x] += dx - best;
+    }
+
+    // Inverse the edges along the augmenting path.
+    int y;
+    if (sink_y == -1) { // `sink_x` gives up its Y vertex to become unassigned
+      y = xe[sink_x] == -1 ? -1 : edge_y[xe[sink_x]];
+      xe[sink_x] = -1;
+    } else {
+      y = sink_y;
+    }
+    while (y != -1 && sink_x != root) {
+      int e = ye[y];
+      int x = edge_x[e];
+      int next_y = xe[x] == -1 ? -1 : edge_y[xe[x]];
+      xe[x] = e;
+      yx[y] = x;
+      if (x == root)
+        break;
+      y = next_y;
+    }
+    for (int y : touched)
+      ye[y] = -1;
+  }
+}
+
+// Min-cost flow version of `SolveSparse`. Each X vertex has `ws.capacity[x]`
+// units & each Y vertex accepts `ws.capacity[NX + y]` of them. Edges carry at
+// most one unit. Every unit of X can also stay unassigned for
+// `unassigned_cost`. Expects the CSR edge arrays of `ws` to be filled.
+//
+// Units are sent one at a time along the shortest paths (Dijkstra over reduced
+// costs `cost + potential[u] - potential[v]`) of the residual graph. Paths
+// go from X to Y through unused edges & back from Y to X through the used
+// ones. Capacities don't add any vertices so a task that takes twenty
+// characters costs as much as any other task.
+template <typename Cost>
+inline void SolveTransport(BasicWorkspace<Cost> &ws, int NX, int NY,
+                           Cost unassigned_cost) {
+  COLONY_PHASE(ws, kSolveSparse);
+  int V = NX + NY;
+  int E = ws.edge_y.size();
+  ws.edge_flow.assign(E, false);
+  ws.load.assign(NY, 0);
+  ws.potential.assign(V, Cost(0));
+  ws.dist.resize(V);
+  ws.parent_edge.resize(V);
+  ws.T.assign(V, 0);
+  FillColumns(ws, NY);
+  const int *column_start = ws.column_start.data();
+  const int *column_edge = ws.column_edge.data();
+
+  const int *row_start = ws.row_start.data();
+  const int *edge_x = ws.edge_x.data(), *edge_y = ws.edge_y.data();
+  const Cost *edge_cost = ws.edge_cost.data();
+  const int *capacity = ws.capacity.data();
+  char *flow = ws.edge_flow.data();
+  int *load = ws.load.data();
+  Cost *potential = ws.potential.data();
+  Cost *dist = ws.dist.data();
+  int *parent_edge = ws.parent_edge.data();
+  char *state = ws.T.data(); // 0 - not reached, 1 - reached, 2 - final
+  auto &touched = ws.touched;
+  auto &heap = ws.heap;
+  const std::greater<std::pair<Cost, int>> heap_order;
+
+  // Make the reduced costs non-negative even if some costs are negative.
+  for (int x = 0; x < NX; ++x) {
+    potential[x] = -unassigned_cost;
+    for (int e = row_start[x]; e < row_start[x + 1]; ++e)
+      potential[x] = std::max(potential[x], -edge_cost[e]);
+  }
+
+  for (int root = 0; root < NX; ++root) {
+    for (int unit = 0; unit < capacity[root]; ++unit) {
+      heap.clear();
+      touched.clear();
+
+      // Best path to the sink found so far. It ends either in a Y vertex with
+      // spare capacity or in the unassigned option of an X vertex.
+      Cost best = unassigned_cost + potential[root];
+      int sink = root;
+
+      auto relax = [&](int v, Cost d, int e) {
+        if (state[v] == 0) {
+          state[v] = 1;
+          touched.push_back(v);
+        } else if (state[v] == 2 || d >= dist[v]) {
+          return;
+        }
+        dist[v] = d;
+        parent_edge[v] = e;
+        heap.emplace_back(d, v);
+        std::push_heap(heap.begin(), heap.end(), heap_order);
+      };
+
+      dist[root] = 0;
+      state[root] = 1;
+      touched.push_back(root);
+      heap.emplace_back(Cost(0), root);
+      while (!heap.empty()) {
+        auto [d, v] = heap.front();
+        std::pop_heap(heap.begin(), heap.end(), heap_order);
+        heap.pop_back();
+        if (state[v] == 2 || d > dist[v])
+          continue; // stale entry
+        if (d >= best)
+          break; // nothing closer than the best path
+        state[v] = 2;
+        if (v < NX) {
+          if (v != root && d + unassigned_cost + potential[v] < best) {
+            best = d + unassigned_cost + potential[v]; // v drops a unit
+            sink = v;
+          }
+          for (int e = row_start[v]; e < row_start[v + 1]; ++e) {
+            int y = NX + edge_y[e];
+            if (!flow[e])
+              relax(y, d + edge_cost[e] + potential[v] - potential[y], e);
+          }
+        } else {
+          if (load[v - NX] < capacity[v] && d + potential[v] < best) {
+            best = d + potential[v]; // v takes another unit
+            sink = v;
+          }
+          for (int i = column_start[v - NX]; i < column_start[v - NX + 1];
+               ++i) {
+            int e = column_edge[i];
+            int x = edge_x[e];
+            if (flow[e])
+              relax(x, d - edge_cost[e] - potential[x] + potential[v], e);
+          }
+        }
+      }
+
+      // Update the potentials so that reduced costs stay non-negative.
+      for (int v : touched) {
+        if (state[v] == 2)
+          potential[v] += dist[v] - best;
+        state[v] = 0;
+      }
+      if (sink == root)
+        break; // the remaining units of the root stay unassigned as well
+
+      // Inverse the edges along the path.
+      if (sink >= NX)
+        ++load[sink - NX];
+      for (int v = sink; v != root;) {
+        int e = parent_edge[v];
+        if (v >= NX) { // reached through an unused edge
+          flow[e] = true;
+          v = edge_x[e];
+        } else { // reached through a used edge
+          flow[e] = false;
+          v = NX + edge_y[e];
+        }
+      }
+    }
+  }
+}
+
+// Auction version of `SolveSparse` (Bertsekas' auction algorithm with epsilon
+// scaling). Fills the same `ws.xe`. Expects the CSR edge arrays of `ws` to be
+// filled.
+//
+// X vertices bid for Y vertices. Each edge is worth the cost it saves over
+// `unassigned_cost` & every X vertex can fall back to staying unassigned
+// (worth 0). A bid raises the price of the best Y vertex by the difference
+// between the two best offers plus `epsilon`. Y vertices that end up
+// unassigned with a non-zero price bid for X vertices instead (reverse auction)
+// & lower their prices, so that the result is also optimal when the sides
+// have different sizes.
+//
+// Every round reuses the prices of the previous one with a smaller `epsilon`.
+// The last round is within `epsilon * (NX + 1)` of the optimum - less than 1
+// for integer costs (which are scaled by `NX + 1`, so the result is exact) &
+// less than the tolerance of `CostTraits::Eq` for the floating-point ones.
+template <typename Cost>
+inline void SolveAuction(BasicWorkspace<Cost> &ws, int NX, int NY,
+                         Cost unassigned_cost) {
+  COLONY_PHASE(ws, kSolveAuction);
+  typedef Price<Cost> P;
+  int E = ws.edge_y.size();
+  FillColumns(ws, NY);
+  ws.benefit.resize(E);
+  ws.price.assign(NY, P(0));
+  ws.profit.resize(NX);
+  ws.xe.resize(NX);
+  ws.ye.resize(NY);
+
+  const int *row_start = ws.row_start.data();
+  const int *column_start = ws.column_start.data();
+  const int *column_edge = ws.column_edge.data();
+  const int *edge_x = ws.edge_x.data(), *edge_y = ws.edge_y.data();
+  P *benefit = ws.benefit.data(), *price = ws.price.data();
+  P *profit = ws.profit.data();
+  int *xe = ws.xe.data(); // xe[x] - edge won by x (-1 unassigned)
+  int *ye = ws.ye.data(); // ye[y] - edge that won y (-1 unassigned)
+  auto &bidders = ws.q;        // X vertices without a Y vertex
+  auto &sellers = ws.touched;  // unassigned Y vertices with non-zero prices
+
+  constexpr bool exact = std::is_integral<Cost>::value;
+  P scale = exact ? P(NX + 1) : P(1);
+  P max_benefit = 0;
+  for (int e = 0; e < E; ++e) {
+    benefit[e] = (P(unassigned_cost) - P(ws.edge_cost[e])) * scale;
+    max_benefit = std::max(max_benefit, benefit[e]);
+  }
+  P final_epsilon = 1;
+  if constexpr (!exact) {
+    P tolerance = 0.0001;
+    if (sizeof(Cost) < sizeof(double))
+      tolerance *= std::max(P(1), max_benefit);
+    // Prices must still change by at least a few ulps in every bid.
+    final_epsilon =
+        std::max(tolerance / (NX + 1),
+                 max_benefit * 64 * std::numeric_limits<P>::epsilon());
+  }
+
+  std::fill(xe, xe + NX, -1);
+  std::fill(ye, ye + NY, -1);
+  const int kReduction = 16; // reduction of epsilon between the rounds
+  for (P epsilon = std::max(final_epsilon, max_benefit / 256);;
+       epsilon = std::max(final_epsilon, epsilon / kReduction)) {
+    // X vertices whose Y vertices are still within `epsilon` of their best
+    // offers keep them. The others bid again.
+    bidders.clear();
+    for (int x = NX - 1; x >= 0; --x) { // X vertices are popped in order
+      P best = 0;
+      for (int e = row_start[x]; e < row_start[x + 1]; ++e)
+        best = std::max(best, benefit[e] - price[edge_y[e]]);
+      int e = xe[x];
+      profit[x] = e == -1 ? P(0) : benefit[e] - price[edge_y[e]];
+      if (profit[x] < best - epsilon) {
+        if (e != -1)
+          ye[edge_y[e]] = -1;
+        xe[x] = -1;
+        profit[x] = best;
+        bidders.push_back(x);
+      }
+    }
+
+    // Forward auction - every X vertex gets a Y vertex or stays unassigned.
+    while (!bidders.empty()) {
+      int x = bidders.back();
+      bidders.pop_back();
+      COLONY_STAT(ws, bids, 1);
+      // Staying unassigned is worth 0 & wins the ties.
+      P best = 0, second = 0;
+      int best_e = -1;
+      for (int e = row_start[x]; e < row_start[x + 1]; ++e) {
+        P offer = benefit[e] - price[edge_y[e]];
+        if (offer > best) {
+          second = best;
+          best = offer;
+          best_e = e;
+        } else if (offer > second) {
+          second = offer;
+        }
+      }
+      if (best_e == -1) {
+        profit[x] = 0;
+        continue;
+      }
+      int y = edge_y[best_e];
+      price[y] += best - second + epsilon;
+      profit[x] = second - epsilon;
+      if (ye[y] != -1) {
+        int loser = edge_x[ye[y]];
+        xe[loser] = -1;
+        bidders.push_back(loser);
+      }
+      xe[x] = best_e;
+      ye[y] = best_e;
+    }
+
+    // Reverse auction - unassigned Y vertices lower their prices to zero or
+    // take an X vertex away from a more expensive Y vertex. X vertices stay
+    // assigned so the forward auction doesn't have to run again.
+    sellers.clear();
+    for (int y = 0; y < NY; ++y)
+      if (ye[y] == -1 && price[y] > 0)
+        sellers.push_back(y);
+    while (!sellers.empty()) {
+      int y = sellers.back();
+      sellers.pop_back();
+      COLONY_STAT(ws, bids, 1);
+      P best = std::numeric_limits<P>::lowest();
+      P second = std::numeric_limits<P>::lowest();
+      int best_e = -1;
+      for (int i = column_start[y]; i < column_start[y + 1]; ++i) {
+        int e = column_edge[i];
+        P offer = benefit[e] - profit[edge_x[e]];
+        if (offer > best) {
+          second = best;
+          best = offer;
+          best_e = e;
+        } else if (offer > second) {
+          second = offer;
+        }
+      }
+      if (best_e == -1 || best - epsilon <= 0) {
+        price[y] = 0;
+        continue;
+      }
+      int x = edge_x[best_e];
+      price[y] = second > epsilon ? second - epsilon : P(0);
+      profit[x] = benefit[best_e] - price[y];
+      if (xe[x] != -1) {
+        int old_y = edge_y[xe[x]];
+        ye[old_y] = -1;
+        if (price[old_y] > 0)
+          sellers.push_back(old_y);
+      }
+      xe[x] = best_e;
+      ye[y] = best_e;
+    }
+
+    if (epsilon == final_epsilon)
+      break;
+  }
+}
+
+// Tells whether the scaled benefits of `SolveAuction` (& the prices built on
+// them) fit into `Price<Cost>`. Integer costs are multiplied by `NX + 1`, which
+// can overflow `int64_t` costs that are otherwise fine for the other solvers.
+// Expects the CSR edge arrays of `ws` to be filled.
+template <typename Cost>
+inline bool AuctionFits(const BasicWorkspace<Cost> &ws, int NX,
+                        Cost unassigned_cost) {
+  if constexpr (std::is_integral<Cost>::value) {
+    long double max_benefit = 0;
+    for (Cost cost : ws.edge_cost)
+      max_benefit = std::max(max_benefit, (long double)unassigned_cost - cost);
+    // Prices can get a few times bigger than the best benefit.
+    long double limit = std::numeric_limits<Price<Cost>>::max() / 8;
+    return max_benefit * (NX + 1) <= limit;
+  } else {
+    return true;
+  }
+}
+
+// Core of `Optimize` with `Engine::Sparse` or `Engine::Auction`. Moves the
+// optimal assignments to the beginning of `assignments` & returns their
+// number.
+template <typename Cost>
+inline int OptimizeEdges(std::span<BasicAssignment<Cost>> assignments,
+                         BasicWorkspace<Cost> &ws, Engine engine) {
+  // Taken before the duplicated pairs are dropped (see `OptimizeInPlace`).
+  Cost max_cost = 0;
+  for (auto &a : assignments) {
+    if (IsPossible(a.cost)) {
+      max_cost = std::max(max_cost, a.cost);
+    }
+  }
+  if (ws.deterministic) {
+    assignments = assignments.first(Canonicalize(assignments));
+  }
+  bool compact = CompactIds<Cost>(assignments, ws);
+  CharacterId max_character = 0;
+  TaskId max_task = 0;
+  for (auto &a : assignments) {
+    max_character = std::max(max_character, a.character);
+    max_task = std::max(max_task, a.task);
+  }
+
+  // Augmenting paths start from X vertices so the smaller side goes there.
+  bool transpose = !(max_task > max_character);
+  int NX = transpose ? max_task + 1 : max_character + 1;
+  int NY = transpose ? max_character + 1 : max_task + 1;
+  int E = assignments.size();
+  FillEdges<Cost>(assignments, ws, NX, transpose);
+
+  // Missing pairs in `Optimize` are worth as much as the most expensive
+  // assignment. Here this is the cost of leaving X vertex unassigned. Huge
+  // integer costs fall back to the sparse engine (see `AuctionFits`).
+  if (engine == Engine::Auction && AuctionFits(ws, NX, max_cost)) {
+    SolveAuction(ws, NX, NY, max_cost);
+  } else {
+    SolveSparse(ws, NX, NY, max_cost);
+  }
+  ws.warm = false; // labels of the dense solver got overwritten
+  ws.compact = compact;
+
+  auto &keep = ws.S;
+  keep.assign(E, false);
+  for (int x = 0; x < NX; ++x) {
+    if (ws.xe[x] != -1) {
+      keep[ws.edge_assignment[ws.xe[x]]] = true;
+    }
+  }
+  int n = 0;
+  for (int i = 0; i < E; ++i) {
+    if (keep[i]) {
+      assignments[n++] = assignments[i];
+    }
+  }
+  if (compact) {
+    RestoreIds(assignments.first(n), ws);
+  }
+  if (ws.deterministic) {
+    std::sort(assignments.begin(), assignments.begin() + n, ById<Cost>);
+  }
+  return n;
+}
+
+// Engine picked by `Engine::Auto`.
+template <typename Cost>
+inline Engine ChooseEngine(std::span<const BasicAssignment<Cost>> assignments,
+                           BasicWorkspace<Cost> &ws) {
+  int64_t num_characters = 0, num_tasks = 0;
+  if (HasSparseIds<Cost>(assignments)) {
+    // Indices of the maps can be bigger than their sizes (they're kept across
+    // frames) & the dense engine uses the indices. `CompactIds` reuses them.
+    UpdateIds<Cost>(assignments, ws);
+    num_characters = ws.character_ids.Capacity();
+    num_tasks = ws.task_ids.Capacity();
+  } else {
+    for (auto &a : assignments) {
+      num_characters = std::max<int64_t>(num_characters, a.character + 1);
+      num_tasks = std::max<int64_t>(num_tasks, a.task + 1);
+    }
+  }
+  // Thresholds come from the bench suite (see src/bench.cc). The dense engine
+  // wins when the matrix is small or when it's mostly filled anyway. Shortest
+  // paths are short when there are many more tasks than characters (or the
+  // other way around). When both sides are similar, the last few characters
+  // compete for the last few tasks & auctions resolve that faster.
+  int64_t pairs = num_characters * num_tasks;
+  int64_t smaller = std::min(num_characters, num_tasks);
+  int64_t bigger = std::max(num_characters, num_tasks);
+  if (pairs <= 1024 || (int64_t)assignments.size() * 4 >= pairs) {
+    return Engine::Dense;
+  }
+  if (smaller >= 100 && bigger * 4 <= smaller * 5) {
+    return Engine::Auction;
+  }
+  return Engine::Sparse;
+}
+
+// Core of the `Optimize` that reads the costs from a function. The solver sees
+// `fill_cost` & the output gets `emit_cost`.
+template <typename Cost, typename FillFn, typename EmitFn>
+inline void OptimizeDense(int num_characters, int num_tasks, FillFn &fill_cost,
+                          EmitFn &emit_cost,
+                          std::vector<BasicAssignment<Cost>> &assignments,
+                          BasicWorkspace<Cost> &ws) {
+  int NX, NY;
+  FillDense(num_characters, num_tasks, fill_cost, ws, NX, NY, ws.transpose);
+  ws.compact = false;
+  SolveDense(ws, NX, NY);
+  EmitMatching(ws, [&] {
+    EmitDense(emit_cost, ws, assignments);
+    return 0;
+  });
+}
+
+// Same as above but for `Reoptimize`.
+template <typename Cost, typename FillFn, typename EmitFn>
+inline void ReoptimizeDense(int num_characters, int num_tasks,
+                            FillFn &fill_cost, EmitFn &emit_cost,
+                            std::vector<BasicAssignment<Cost>> &assignments,
+                            BasicWorkspace<Cost> &ws) {
+  int old_NX = ws.NX, old_NY = ws.NY;
+  bool old_transpose = ws.transpose;
+  bool old_compact = ws.compact;
+  std::swap(ws.value, ws.prev_value);
+  int NX, NY;
+  FillDense(num_characters, num_tasks, fill_cost, ws, NX, NY, ws.transpose);
+  ws.compact = false;
+  ResolveDense(ws, NX, NY, old_NX, old_NY,
+               ws.transpose == old_transpose && !old_compact);
+  EmitMatching(ws, [&] {
+    EmitDense(emit_cost, ws, assignments);
+    return 0;
+  });
+}
+
+// Wraps `cost` so that the incumbents (see `SetIncumbents`) get cheaper by
+// `switching_penalty`.
+template <typename Cost, typename CostFn>
+inline auto StableCost(CostFn &cost, Cost switching_penalty,
+                       const BasicWorkspace<Cost> &ws) {
+  return [&cost, switching_penalty, &ws](CharacterId c, TaskId t) {
+    Cost value = cost(c, t);
+    if (value < CostTraits<Cost>::Infinity() && FindIncumbent(ws, c, t) != -1)
+      value -= switching_penalty;
+    return value;
+  };
+}
+
+// Core of `LimitAssignments`. Reads the assignments from `input` & writes the
+// kept ones to `assignments` (which may be the same as `input`).
+template <typename Cost, typename Rows>
+inline void LimitRows(const Rows &input,
+                      std::vector<BasicAssignment<Cost>> &assignments,
+                      int limit_per_character, int limit_per_task,
+                      BasicWorkspace<Cost> &workspace) {
+  COLONY_PHASE(workspace, kLimitAssignments);
+  // Ties are broken by the original ids so they can't be compacted. Sparse
+  // ids are only translated to dense indices for grouping.
+  auto &character_ids = workspace.group_characters;
+  auto &task_ids = workspace.group_tasks;
+  int num_characters = 0, num_tasks = 0;
+  bool sparse = HasSparseIds<Cost>(input);
+  if (sparse) {
+    character_ids.Clear();
+    task_ids.Clear();
+    for (size_t i = 0; i < input.size(); ++i) {
+      auto &&a = input[i];
+      character_ids.Insert(a.character);
+      task_ids.Insert(a.task);
+    }
+    num_characters = character_ids.Capacity();
+    num_tasks = task_ids.Capacity();
+  } else {
+    for (size_t i = 0; i < input.size(); ++i) {
+      auto &&a = input[i];
+      num_characters = std::max(num_characters, a.character + 1);
+      num_tasks = std::max(num_tasks, a.task + 1);
+    }
+  }
+  KeepCheapest(
+      input, assignments, num_characters,
+      [&](const BasicAssignment<Cost> &a) {
+        return sparse ? character_ids.Find(a.character) : a.character;
+      },
+      limit_per_character, workspace);
+  KeepCheapest(
+      assignments, assignments, num_tasks,
+      [&](const BasicAssignment<Cost> &a) {
+        return sparse ? task_ids.Find(a.task) : a.task;
+      },
+      limit_per_task, workspace);
+  if (sparse) { // groups of the indices are in the order of the id maps
+    std::stable_sort(assignments.begin(), assignments.end(),
+                     [](auto &a, auto &b) { return a.task < b.task; });
+  }
+}
+
+} // namespace internal
+
+// Reduce the number of potential assignments for each character & task.
+//
+// First keeps only the `limit_per_character` cheapest assignments of each
+// character. Then, out of those, keeps the `limit_per_task` cheapest
+// assignments of each task. Ties are broken by character & task ids so the
+// result doesn't depend on the order of the input.
+//
+// The second pass can leave a character without any assignment - when all of
+// its kept tasks go to cheaper characters, even though its next best task is
+// free. Use `limit_per_task >= limit_per_character` when every character must
+// keep a candidate.
+//
+// Runs in linear time (plus sorting of the kept assignments when the ids are
+// sparse). The result is grouped by task (in the order of task ids) & sorted by
+// cost within each task.
+template <typename Cost>
+inline void LimitAssignments(std::vector<BasicAssignment<Cost>> &assignments,
+                             int limit_per_character, int limit_per_task,
+                             BasicWorkspace<Cost> &workspace) {
+  internal::LimitRows(assignments, assignments, limit_per_character,
+                      limit_per_task, workspace);
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void LimitAssignments(std::vector<BasicAssignment<Cost>> &assignments,
+                             int limit_per_character, int limit_per_task) {
+  LimitAssignments(assignments, limit_per_character, limit_per_task,
+                   DefaultWorkspace<Cost>());
+}
+
+// Variant of `LimitAssignments` for assignments stored in columns. The input
+// isn't modified - the kept assignments are written to `output`.
+template <typename Cost>
+inline void
+LimitAssignments(std::type_identity_t<BasicAssignmentColumns<Cost>> assignments,
+                 int limit_per_character, int limit_per_task,
+                 BasicAssignmentBuffer<Cost> &output,
+                 BasicWorkspace<Cost> &workspace) {
+  auto &rows = workspace.rows;
+  internal::LimitRows(assignments, rows, limit_per_character, limit_per_task,
+                      workspace);
+  output.clear();
+  output.reserve(rows.size());
+  for (auto &a : rows) {
+    output.push_back(a);
+  }
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void
+LimitAssignments(std::type_identity_t<BasicAssignmentColumns<Cost>> assignments,
+                 int limit_per_character, int limit_per_task,
+                 BasicAssignmentBuffer<Cost> &output) {
+  LimitAssignments(assignments, limit_per_character, limit_per_task, output,
+                   DefaultWorkspace<Cost>());
+}
+
+// Variant of `LimitAssignments` that reads the costs directly from
+// `cost(character, task)` so that the full list of potential assignments
+// never has to be built. Characters are [0, num_characters) and tasks are
+// [0, num_tasks). Pairs with infinite cost are skipped. The result (same as in
+// the first variant) is written to `assignments`.
+//
+// Uses bounded heaps so the memory needed is O(num_tasks * limit_per_task).
+template <typename Cost, typename CostFn>
+inline void LimitAssignments(int num_characters, int num_tasks, CostFn &&cost,
+                             int limit_per_character, int limit_per_task,
+                             std::vector<BasicAssignment<Cost>> &assignments,
+                             BasicWorkspace<Cost> &workspace) {
+  COLONY_PHASE(workspace, kLimitAssignments);
+  limit_per_character = std::max(limit_per_character, 0);
+  limit_per_task = std::max(limit_per_task, 0);
+  auto &heaps = workspace.scratch; // bounded max-heaps of each task
+  auto &heap_size = workspace.group_size;
+  heaps.resize((size_t)num_tasks * limit_per_task);
+  heap_size.assign(num_tasks, 0);
+  assignments.clear();
+  for (CharacterId c = 0; c < num_characters; ++c) {
+    // The cheapest tasks of `c` are collected (temporarily) in `assignments`.
+    for (TaskId t = 0; t < num_tasks; ++t) {
+      BasicAssignment<Cost> a = {c, t, (Cost)cost(c, t)};
+      if (!(a.cost < CostTraits<Cost>::Infinity())) {
+        continue;
+      }
+      if ((int)assignments.size() < limit_per_character) {
+        assignments.push_back(a);
+        std::push_heap(assignments.begin(), assignments.end(),
+                       internal::Cheaper<Cost>);
+      } else if (limit_per_character > 0 &&
+                 internal::Cheaper(a, assignments[0])) {
+        std::pop_heap(assignments.begin(), assignments.end(),
+                      internal::Cheaper<Cost>);
+        assignments.back() = a;
+        std::push_heap(assignments.begin(), assignments.end(),
+                       internal::Cheaper<Cost>);
+      }
+    }
+    // Move them to the heaps of their tasks.
+    for (const BasicAssignment<Cost> &a : assignments) {
+      auto heap = heaps.begin() + (size_t)a.task * limit_per_task;
+      int &size = heap_size[a.task];
+      if (size < limit_per_task) {
+        heap[size++] = a;
+        std::push_heap(heap, heap + size, internal::Cheaper<Cost>);
+      } else if (limit_per_task > 0 && internal::Cheaper(a, heap[0])) {
+        std::pop_heap(heap, heap + size, internal::Cheaper<Cost>);
+        heap[size - 1] = a;
+        std::push_heap(heap, heap + size, internal::Cheaper<Cost>);
+      }
+    }
+    assignments.clear();
+  }
+  for (TaskId t = 0; t < num_tasks; ++t) {
+    auto heap = heaps.begin() + (size_t)t * limit_per_task;
+    std::sort_heap(heap, heap + heap_size[t], internal::Cheaper<Cost>);
+    assignments.insert(assignments.end(), heap, heap + heap_size[t]);
+  }
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost, typename CostFn>
+inline void LimitAssignments(int num_characters, int num_tasks, CostFn &&cost,
+                             int limit_per_character, int limit_per_task,
+                             std::vector<BasicAssignment<Cost>> &assignments) {
+  LimitAssignments(num_characters, num_tasks, std::forward<CostFn>(cost),
+                   limit_per_character, limit_per_task, assignments,
+                   DefaultWorkspace<Cost>());
+}
+
+// The main function of this library. It takes a vector of potential assigments
+// of characters to tasks and removes all assignments that are not optimal.
+// When the same pair is listed more than once, only its cheapest copy can be
+// kept.
+//
+// When the assignments fall apart into groups that don't share any characters
+// or tasks (for example colonies on separate islands), each group is solved
+// on its own - in parallel if the workspace has an `executor`. This is skipped
+// for dense problems & when `split_components` of the workspace is cleared.
+//
+// All of the temporary memory comes from the given `workspace`.
+template <typename Cost>
+inline void Optimize(std::vector<BasicAssignment<Cost>> &assignments,
+                     BasicWorkspace<Cost> &workspace) {
+  assignments.resize(
+      internal::OptimizeInPlace<Cost>(assignments, workspace));
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void Optimize(std::vector<BasicAssignment<Cost>> &assignments) {
+  Optimize(assignments, DefaultWorkspace<Cost>());
+}
+
+// Variant of `Optimize` that runs the given `engine`. All engines produce
+// assignments of the same total cost. `Engine::Dense` is the same as the
+// `Optimize` above. `Engine::Sparse` is the same as `OptimizeSparse`.
+// `Engine::Auction` also works only on the given assignments & is usually the
+// fastest one when there are thousands of characters & each of them can take
+// only a few tasks (for example after `LimitAssignments`). Integer costs that
+// would overflow its scaled prices use `Engine::Sparse` instead. `Engine::Auto`
+// picks the engine from the number & density of the assignments.
+template <typename Cost>
+inline void Optimize(std::vector<BasicAssignment<Cost>> &assignments,
+                     Engine engine, BasicWorkspace<Cost> &workspace) {
+  if (engine == Engine::Auto) {
+    engine = internal::ChooseEngine<Cost>(assignments, workspace);
+  }
+  if (engine == Engine::Dense) {
+    Optimize(assignments, workspace);
+  } else {
+    assignments.resize(
+        internal::OptimizeEdges<Cost>(assignments, workspace, engine));
+  }
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void Optimize(std::vector<BasicAssignment<Cost>> &assignments,
+                     Engine engine) {
+  Optimize(assignments, engine, DefaultWorkspace<Cost>());
+}
+
+// Variant of `Optimize` for assignments stored in columns. The input isn't
+// modified - optimal assignments (at most one per character & task) are
+// written to `output` instead. Ids should be dense - sparse ones are copied
+// into rows. Works well with the columns from `LimitAssignments`.
+template <typename Cost>
+inline void
+Optimize(std::type_identity_t<BasicAssignmentColumns<Cost>> assignments,
+         BasicAssignmentBuffer<Cost> &output, BasicWorkspace<Cost> &workspace) {
+  internal::OptimizeColumns<Cost>(assignments, output, workspace);
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void
+Optimize(std::type_identity_t<BasicAssignmentColumns<Cost>> assignments,
+         BasicAssignmentBuffer<Cost> &output) {
+  Optimize(assignments, output, DefaultWorkspace<Cost>());
+}
+
+// Anytime variant of `Optimize` for frames with a hard time budget. When the
+// `deadline` passes, the solver stops looking for augmenting paths & completes
+// the assignment greedily. Returns whether the result is optimal.
+//
+// The partial matching stays in `workspace` so that the following calls of
+// `Reoptimize` continue from it (instead of starting over). Games that can't
+// afford a single long frame should call `Reoptimize` with a deadline on
+// every frame - a few frames after a spike the results are optimal again.
+template <typename Cost>
+inline bool Optimize(std::vector<BasicAssignment<Cost>> &assignments,
+                     Deadline deadline, BasicWorkspace<Cost> &workspace) {
+  Deadline old_deadline = std::exchange(workspace.deadline, deadline);
+  Optimize(assignments, workspace);
+  workspace.deadline = old_deadline;
+  return workspace.optimal;
+}
+
+namespace internal {
+
+// Core of `Reoptimize`. Missing pairs are worth at least `unassigned_cost`.
+template <typename Cost>
+inline void ReoptimizeRows(std::vector<BasicAssignment<Cost>> &assignments,
+                           BasicWorkspace<Cost> &ws, Cost unassigned_cost = 0) {
+  if (ws.deterministic) { // same result as `Optimize`
+    assignments.resize(OptimizeInPlace<Cost>(assignments, ws, unassigned_cost));
+    return;
+  }
+  int old_NX = ws.NX, old_NY = ws.NY;
+  bool old_transpose = ws.transpose;
+  bool old_compact = ws.compact;
+  ws.compact = CompactIds<Cost>(assignments, ws);
+  std::swap(ws.value, ws.prev_value);
+  int NX, NY;
+  FillDense<Cost>(assignments, ws, NX, NY, ws.transpose, unassigned_cost);
+  ResolveDense(ws, NX, NY, old_NX, old_NY,
+               ws.transpose == old_transpose && ws.compact == old_compact);
+  assignments.resize(EmitMatching(
+      ws, [&] { return FilterDense<Cost>(assignments, ws); }));
+  if (ws.compact) {
+    RestoreIds<Cost>(assignments, ws);
+  }
+}
+
+} // namespace internal
+
+// Incremental version of `Optimize` meant to be called on every frame.
+//
+// Starts from the labels & matching left in `workspace` by the previous call
+// of `Optimize` or `Reoptimize`. Only characters & tasks whose costs changed
+// (or which were added or removed) are detached from the previous matching
+// and only they have to be matched again. When k of them change, this costs
+// O(k * n^2) on top of the O(n^2) needed to read in the costs.
+//
+// Character & task ids should stay the same across frames for this to work
+// well. The result is always optimal - just like the one from `Optimize`.
+template <typename Cost>
+inline void Reoptimize(std::vector<BasicAssignment<Cost>> &assignments,
+                       BasicWorkspace<Cost> &workspace) {
+  internal::ReoptimizeRows<Cost>(assignments, workspace);
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void Reoptimize(std::vector<BasicAssignment<Cost>> &assignments) {
+  Reoptimize(assignments, DefaultWorkspace<Cost>());
+}
+
+// Anytime variant of `Reoptimize`. See the `Optimize` with a `deadline` above.
+// Work done before the deadline is kept so the next call picks up where this
+// one stopped.
+template <typename Cost>
+inline bool Reoptimize(std::vector<BasicAssignment<Cost>> &assignments,
+                       Deadline deadline, BasicWorkspace<Cost> &workspace) {
+  Deadline old_deadline = std::exchange(workspace.deadline, deadline);
+  Reoptimize(assignments, workspace);
+  workspace.deadline = old_deadline;
+  return workspace.optimal;
+}
+
+// Variant of `Optimize` that reads the costs directly from
+// `cost(character, task)` instead of a vector of potential assignments.
+// Characters are [0, num_characters) and tasks are [0, num_tasks). Pairs that
+// are not possible should have infinite cost. Optimal assignments are written
+// to `assignments`.
+//
+// The costs go straight into the cost matrix of the solver so the full list of
+// potential assignments never has to be built. Each pair is evaluated once
+// (plus once more for the assignments written to the output).
+template <typename Cost, typename CostFn>
+inline void Optimize(int num_characters, int num_tasks, CostFn &&cost,
+                     std::vector<BasicAssignment<Cost>> &assignments,
+                     BasicWorkspace<Cost> &workspace) {
+  internal::OptimizeDense(num_characters, num_tasks, cost, cost, assignments,
+                          workspace);
+}
+
+// Same as above but returns the assignments & uses the `DefaultWorkspace()` of
+// the calling thread. Costs are `double` unless `Cost` is given explicitly.
+template <typename Cost = double, typename CostFn>
+inline std::vector<BasicAssignment<Cost>>
+Optimize(int num_characters, int num_tasks, CostFn &&cost) {
+  std::vector<BasicAssignment<Cost>> assignments;
+  Optimize(num_characters, num_tasks, cost, assignments,
+           DefaultWorkspace<Cost>());
+  return assignments;
+}
+
+// Variant of `Reoptimize` that reads the costs from `cost(character, task)`.
+// See the `Optimize` above.
+template <typename Cost, typename CostFn>
+inline void Reoptimize(int num_characters, int num_tasks, CostFn &&cost,
+                       std::vector<BasicAssignment<Cost>> &assignments,
+                       BasicWorkspace<Cost> &workspace) {
+  internal::ReoptimizeDense(num_characters, num_tasks, cost, cost, assignments,
+                            workspace);
+}
+
+// Variants of `Optimize` & `Reoptimize` that keep the characters on the tasks
+// they were assigned in `previous` (usually the result of the last frame)
+// unless switching saves more than `switching_penalty`.
+//
+// The solver sees the incumbent assignments as cheaper by `switching_penalty`
+// (the output has the original costs). This stops the assignment from
+// flapping between equally good tasks without adjusting the costs by hand.
+// The bonus puts the incumbent assignments into the initial matching of the
+// solver so keeping them is also cheap.
+template <typename Cost>
+inline void
+Optimize(std::vector<BasicAssignment<Cost>> &assignments,
+         std::type_identity_t<std::span<const BasicAssignment<Cost>>> previous,
+         std::type_identity_t<Cost> switching_penalty,
+         BasicWorkspace<Cost> &workspace) {
+  internal::AddIncumbentBonus<Cost>(assignments, previous, switching_penalty,
+                                    workspace);
+  Optimize(assignments, workspace);
+  internal::RemoveIncumbentBonus<Cost>(assignments, workspace);
+}
+
+template <typename Cost>
+inline void
+Reoptimize(std::vector<BasicAssignment<Cost>> &assignments,
+           std::type_identity_t<std::span<const BasicAssignment<Cost>>>
+               previous,
+           std::type_identity_t<Cost> switching_penalty,
+           BasicWorkspace<Cost> &workspace) {
+  internal::AddIncumbentBonus<Cost>(assignments, previous, switching_penalty,
+                                    workspace);
+  Reoptimize(assignments, workspace);
+  internal::RemoveIncumbentBonus<Cost>(assignments, workspace);
+}
+
+template <typename Cost, typename CostFn>
+inline void
+Optimize(int num_characters, int num_tasks, CostFn &&cost,
+         std::type_identity_t<std::span<const BasicAssignment<Cost>>> previous,
+         std::type_identity_t<Cost> switching_penalty,
+         std::vector<BasicAssignment<Cost>> &assignments,
+         BasicWorkspace<Cost> &workspace) {
+  internal::SetIncumbents<Cost>(previous, workspace);
+  auto stable_cost = internal::StableCost<Cost>(cost, switching_penalty,
+                                                workspace);
+  internal::OptimizeDense(num_characters, num_tasks, stable_cost, cost,
+                          assignments, workspace);
+}
+
+template <typename Cost, typename CostFn>
+inline void
+Reoptimize(int num_characters, int num_tasks, CostFn &&cost,
+           std::type_identity_t<std::span<const BasicAssignment<Cost>>>
+               previous,
+           std::type_identity_t<Cost> switching_penalty,
+           std::vector<BasicAssignment<Cost>> &assignments,
+           BasicWorkspace<Cost> &workspace) {
+  internal::SetIncumbents<Cost>(previous, workspace);
+  auto stable_cost = internal::StableCost<Cost>(cost, switching_penalty,
+                                                workspace);
+  internal::ReoptimizeDense(num_characters, num_tasks, stable_cost, cost,
+                            assignments, workspace);
+}
+
+namespace internal {
+
+// Dual of a character (or a task when `task` is set) in the last dense solve
+// of `ws`, expressed in savings (see `CharacterValue`).
+template <typename Cost>
+inline Cost Dual(const BasicWorkspace<Cost> &ws, int id, bool task) {
+  if (ws.compact) {
+    id = task ? ws.task_ids.Find(id) : ws.character_ids.Find(id);
+  }
+  if (task == ws.transpose) { // X vertex
+    return id >= 0 && id < ws.NX ? ws.lx[id] + ws.max_cost : Cost(0);
+  }
+  return id >= 0 && id < ws.NY ? ws.ly[id] : Cost(0);
+}
+
+} // namespace internal
+
+// What-if queries (see the "What-if queries" section at the top).
+//
+// They read the labels (LP duals) left by the last dense solve of `workspace`
+// - `Reoptimize`, the variants that take a cost function & `Optimize` when the
+// problem didn't fall apart into components. `HasValues` tells whether the
+// labels are there & whether the solve finished before its deadline.
+template <typename Cost> inline bool HasValues(const BasicWorkspace<Cost> &ws) {
+  return ws.warm && ws.optimal;
+}
+
+// Marginal value of `character` - by how much the total savings would drop
+// without it. Assigning a character to a task saves as much as the most
+// expensive potential assignment costs minus the cost of the pair. Characters
+// that weren't part of the last problem are worth 0.
+template <typename Cost>
+inline Cost CharacterValue(const BasicWorkspace<Cost> &workspace,
+                           CharacterId character) {
+  return internal::Dual(workspace, character, false);
+}
+
+// Same as above but for `task`.
+template <typename Cost>
+inline Cost TaskValue(const BasicWorkspace<Cost> &workspace, TaskId task) {
+  return internal::Dual(workspace, task, true);
+}
+
+// Cost that the pair of `character` & `task` has to go below in order to be
+// picked. At this cost or above the last assignment stays optimal. Labels
+// aren't unique so when some other assignment is just as good, the pair may
+// need to get a bit cheaper still. Assigned pairs get their own cost.
+template <typename Cost>
+inline Cost BreakEvenCost(const BasicWorkspace<Cost> &workspace,
+                          CharacterId character, TaskId task) {
+  return workspace.max_cost - CharacterValue(workspace, character) -
+         TaskValue(workspace, task);
+}
+
+// Whether adding the potential assignments in `added` (or making the existing
+// pairs cheaper) may change the result of the last solve. When it returns
+// false the last assignment stays optimal & the solve can be skipped. A new
+// task can be checked by passing its pairs with all characters that could take
+// it. Costs O(1) per pair.
+template <typename Cost>
+inline bool
+MayChange(const BasicWorkspace<Cost> &workspace,
+            std::type_identity_t<std::span<const BasicAssignment<Cost>>>
+                added) {
+  for (auto &a : added) {
+    Cost break_even = BreakEvenCost(workspace, a.character, a.task);
+    if (a.cost < break_even && !internal::Eq(a.cost, break_even)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Alternative to `Optimize` which is faster when each character can be
+// assigned only to a few tasks (for example after `LimitAssignments`).
+//
+// Produces assignments of the same total cost as `Optimize` but doesn't build
+// the dense cost matrix. Instead it works directly on the edges given in
+// `assignments` so its cost scales with the number of potential assignments
+// rather than the number of characters times the number of tasks.
+template <typename Cost>
+inline void OptimizeSparse(std::vector<BasicAssignment<Cost>> &assignments,
+                           BasicWorkspace<Cost> &workspace) {
+  assignments.resize(
+      internal::OptimizeEdges<Cost>(assignments, workspace, Engine::Sparse));
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void OptimizeSparse(std::vector<BasicAssignment<Cost>> &assignments) {
+  OptimizeSparse(assignments, DefaultWorkspace<Cost>());
+}
+
+// Variant of `OptimizeSparse` where tasks can be done by many characters at
+// once & characters can take many tasks. Task `t` takes up to
+// `task_capacity[t]` characters & character `c` takes up to
+// `character_capacity[c]` tasks. Ids past the end of the spans (or all of
+// them when a span is empty) & negative ids have a capacity of 1. Each pair
+// is assigned at most once - duplicated pairs keep the cheapest cost &
+// impossible pairs are skipped.
+//
+// Sparse ids are remapped like in `Optimize`. The result is an optimal
+// transportation plan: the side with fewer units gets as many of them
+// assigned as cheaply as possible. Leaving a unit unassigned costs as much as
+// the most expensive assignment - just like a missing pair in `Optimize`. Its
+// cost scales with the number of potential assignments times the number of
+// units but not with the capacities of the other side.
+template <typename Cost>
+inline void OptimizeCapacitated(std::vector<BasicAssignment<Cost>> &assignments,
+                                std::span<const int> character_capacity,
+                                std::span<const int> task_capacity,
+                                BasicWorkspace<Cost> &workspace) {
+  std::erase_if(assignments,
+                [](auto &a) { return !internal::IsPossible(a.cost); });
+  // Like in `Optimize` the expensive copies of a pair count towards the cost
+  // of a missing pair.
+  Cost max_cost = 0;
+  for (auto &a : assignments) {
+    max_cost = std::max(max_cost, a.cost);
+  }
+  // Copies of a pair would be separate edges of the flow network.
+  assignments.resize(internal::Canonicalize<Cost>(assignments));
+  bool compact = internal::CompactIds<Cost>(assignments, workspace);
+  int num_characters = 0, num_tasks = 0;
+  for (auto &a : assignments) {
+    num_characters = std::max(num_characters, a.character + 1);
+    num_tasks = std::max(num_tasks, a.task + 1);
+  }
+  // Capacities are looked up by the original ids. Unused indices of the id
+  // maps have no units.
+  auto units = [&](std::span<const int> capacity, const IdMap<int> &ids,
+                   int i) {
+    if (compact && !ids.IsLive(i)) {
+      return 0;
+    }
+    int id = compact ? ids[i] : i;
+    return (size_t)id < capacity.size() ? std::max(capacity[id], 0) : 1;
+  };
+  auto character_units_of = [&](int c) {
+    return units(character_capacity, workspace.character_ids, c);
+  };
+  auto task_units_of = [&](int t) {
+    return units(task_capacity, workspace.task_ids, t);
+  };
+  int64_t character_units = 0, task_units = 0;
+  for (CharacterId c = 0; c < num_characters; ++c) {
+    character_units += character_units_of(c);
+  }
+  for (TaskId t = 0; t < num_tasks; ++t) {
+    task_units += task_units_of(t);
+  }
+
+  // Paths start from the units of X vertices so the side with fewer units goes
+  // there.
+  bool transpose = !(task_units > character_units);
+  int NX = transpose ? num_tasks : num_characters;
+  int NY = transpose ? num_characters : num_tasks;
+  int E = assignments.size();
+  auto &capacity = workspace.capacity;
+  capacity.resize(NX + NY);
+  for (int x = 0; x < NX; ++x) {
+    capacity[x] = transpose ? task_units_of(x) : character_units_of(x);
+  }
+  for (int y = 0; y < NY; ++y) {
+    capacity[NX + y] = transpose ? character_units_of(y) : task_units_of(y);
+  }
+
+  internal::FillEdges<Cost>(assignments, workspace, NX, transpose);
+  internal::SolveTransport(workspace, NX, NY, max_cost);
+  workspace.warm = false; // labels of the dense solver got overwritten
+  workspace.compact = compact;
+
+  auto &keep = workspace.S;
+  keep.assign(E, false);
+  for (int e = 0; e < E; ++e) {
+    if (workspace.edge_flow[e]) {
+      keep[workspace.edge_assignment[e]] = true;
+    }
+  }
+  int n = 0;
+  for (int i = 0; i < E; ++i) {
+    if (keep[i]) {
+      assignments[n++] = assignments[i];
+    }
+  }
+  assignments.resize(n);
+  if (compact) {
+    internal::RestoreIds<Cost>(assignments, workspace);
+  }
+  if (workspace.deterministic) {
+    std::sort(assignments.begin(), assignments.end(), internal::ById<Cost>);
+  }
+}
+
+// Same as above but uses the `DefaultWorkspace()` of the calling thread.
+template <typename Cost>
+inline void
+OptimizeCapacitated(std::vector<BasicAssignment<Cost>> &assignments,
+                    std::span<const int> character_capacity,
+                    std::span<const int> task_capacity) {
+  OptimizeCapacitated(assignments, character_capacity, task_capacity,
+                      DefaultWorkspace<Cost>());
+}
+
+// Memory used by `OptimizeTiered`. Keep it across frames - every tier keeps
+// its own labels & matching so that each of them can warm-start on the next
+// frame.
+template <typename Cost> struct BasicTieredWorkspace {
+  std::vector<BasicWorkspace<Cost>> tiers; // solves each tier
+  std::vector<BasicAssignment<Cost>> tier; // potential assignments of a tier
+  std::vector<BasicAssignment<Cost>> result; // assignments of all tiers
+  IdMap<CharacterId> characters; // dense indices of the characters
+  std::vector<int> character;    // index of the character of each assignment
+  std::vector<Cost> max_cost;    // most expensive assignment of each tier
+  std::vector<char> busy;        // characters taken by the previous tiers
+};
+
+typedef BasicTieredWorkspace<double> TieredWorkspace;
+
+// Variant of `Optimize` for tasks that must not be starved. Instead of
+// dividing their costs by a priority, tasks are split into tiers - task `t`
+// belongs to tier `task_tier[t]` (ids past the end of the span are in tier 0).
+//
+// Tier 0 is assigned first & its assignment is optimal, no matter how cheap
+// the tasks of the other tiers are. Characters left without a task go to
+// tier 1, and so on. Each tier is a separate (smaller) problem solved with
+// `Reoptimize` so the tiers that didn't change since the last frame are
+// cheap. Costs of different tiers are never compared so they can use
+// unrelated units.
+//
+// Within a tier a pair is left out only if it costs as much as the most
+// expensive potential assignment of that tier (including the pairs of the
+// characters taken by the previous tiers). Impossible pairs are skipped &
+// ids can be sparse (or negative) - like in `Optimize`. Characters of a tier
+// never switch to another task of that tier in order to free up a better task
+// for the following tiers.
+template <typename Cost>
+inline void OptimizeTiered(std::vector<BasicAssignment<Cost>> &assignments,
+                           std::span<const int> task_tier,
+                           BasicTieredWorkspace<Cost> &workspace) {
+  BasicTieredWorkspace<Cost> &ws = workspace;
+  auto tier_of = [&](TaskId t) {
+    return (size_t)t < task_tier.size() ? std::max(task_tier[t], 0) : 0;
+  };
+  std::erase_if(assignments,
+                [](auto &a) { return !internal::IsPossible(a.cost); });
+  int num_tiers = 0;
+  ws.characters.Clear();
+  ws.character.resize(assignments.size());
+  ws.max_cost.clear();
+  for (size_t i = 0; i < assignments.size(); ++i) {
+    auto &a = assignments[i];
+    int k = tier_of(a.task);
+    if (k >= num_tiers) {
+      num_tiers = k + 1;
+      ws.max_cost.resize(num_tiers, 0);
+    }
+    ws.max_cost[k] = std::max(ws.max_cost[k], a.cost);
+    ws.character[i] = ws.characters.Insert(a.character);
+  }
+  if ((int)ws.tiers.size() < num_tiers) {
+    ws.tiers.resize(num_tiers);
+  }
+  ws.busy.assign(ws.characters.Capacity(), false);
+  ws.result.clear();
+  for (int k = 0; k < num_tiers; ++k) {
+    ws.tier.clear();
+    for (size_t i = 0; i < assignments.size(); ++i) {
+      auto &a = assignments[i];
+      if (tier_of(a.task) == k && !ws.busy[ws.character[i]]) {
+        ws.tier.push_back(a);
+      }
+    }
+    internal::ReoptimizeRows<Cost>(ws.tier, ws.tiers[k], ws.max_cost[k]);
+    for (auto &a : ws.tier) {
+      ws.busy[ws.characters.Find(a.character)] = true;
+    }
+    ws.result.insert(ws.result.end(), ws.tier.begin(), ws.tier.end());
+  }
+  assignments.swap(ws.result);
+}
+
+// Independent assignment problem solved by `OptimizeBatch`.
+template <typename Cost> struct BasicProblem {
+  std::span<const BasicAssignment<Cost>> assignments; // potential assignments
+};
+
+typedef BasicProblem<double> Problem;
+
+// Memory used by `OptimizeBatch`. Keep it across calls.
+template <typename Cost> struct BasicBatchWorkspace {
+  // Runs the workers (see `Executor`). Without it the problems are solved one
+  // after another by the calling thread.
+  Executor executor;
+  int num_workers = std::max(1, (int)std::thread::hardware_concurrency());
+
+  // Deadline of all problems (see `BasicWorkspace::deadline`). `optimal` tells
+  // whether all of them were solved before it.
+  Deadline deadline = Deadline::max();
+  bool optimal = true;
+
+  bool deterministic = false; // see `BasicWorkspace::deterministic`
+
+  std::vector<BasicWorkspace<Cost>> workers; // workspace of each worker
+  std::vector<BasicAssignment<Cost>> arena;  // all problems packed together
+  std::vector<int> start; // problem i is [start[i], start[i + 1]) of `arena`
+  std::vector<int> order; // problems sorted from the biggest one
+  std::vector<int> kept;  // number of optimal assignments of each problem
+};
+
+typedef BasicBatchWorkspace<double> BatchWorkspace;
+
+namespace internal {
+
+// Bytes held by the given buffers.
+template <typename... T> inline size_t Bytes(const std::vector<T> &...buffers) {
+  return (0 + ... + (buffers.capacity() * sizeof(T)));
+}
+
+} // namespace internal
+
+template <typename Cost>
+inline size_t MemoryUsage(const BasicBatchWorkspace<Cost> &workspace);
+
+// Bytes of memory held by `workspace`. Its buffers only grow so this is the
+// high-water mark of the problems solved with it so far.
+template <typename Cost>
+inline size_t MemoryUsage(const BasicWorkspace<Cost> &workspace) {
+  const BasicWorkspace<Cost> &ws = workspace;
+  size_t bytes = internal::Bytes(
+      ws.value, ws.lx, ws.ly, ws.xy, ws.yx, ws.S, ws.T, ws.slack, ws.slackx,
+      ws.prev, ws.q, ws.pending, ws.hits, ws.job_min, ws.job_next,
+      ws.greedy_xy, ws.greedy_x, ws.prev_value, ws.dirty_x, ws.dirty_y, ws.seen,
+      ws.component_parent, ws.component, ws.component_index,
+      ws.component_start, ws.component_characters, ws.component_vertices,
+      ws.row_start, ws.edge_x, ws.edge_y, ws.edge_cost, ws.edge_assignment,
+      ws.px, ws.py, ws.xe, ws.dist, ws.ye, ws.touched, ws.heap, ws.capacity,
+      ws.column_start, ws.column_edge, ws.edge_flow, ws.load, ws.potential,
+      ws.parent_edge, ws.benefit, ws.price, ws.profit, ws.incumbents,
+      ws.incumbent_slot, ws.incumbent_cost, ws.scratch, ws.rows,
+      ws.group_start, ws.group_size, ws.plan_cost, ws.busy_until,
+      ws.last_task);
+  for (auto &hits : ws.hits) {
+    bytes += internal::Bytes(hits);
+  }
+  bytes += ws.character_ids.MemoryUsage() + ws.task_ids.MemoryUsage() +
+           ws.group_characters.MemoryUsage() + ws.group_tasks.MemoryUsage();
+  if (ws.components) {
+    bytes += sizeof(*ws.components) + MemoryUsage(*ws.components);
+  }
+  return bytes;
+}
+
+// Same as above but for the workspace of `OptimizeBatch`.
+template <typename Cost>
+inline size_t MemoryUsage(const BasicBatchWorkspace<Cost> &workspace) {
+  const BasicBatchWorkspace<Cost> &ws = workspace;
+  size_t bytes =
+      internal::Bytes(ws.workers, ws.arena, ws.start, ws.order, ws.kept);
+  for (auto &worker : ws.workers) {
+    bytes += MemoryUsage(worker);
+  }
+  return bytes;
+}
+
+// Frees all memory held by `workspace` - for example after a rare, huge
+// problem. The state left for `Reoptimize` is dropped too. Settings
+// (`executor`, `columns_per_job`, `split_components` & `deterministic`) are
+// kept.
+template <typename Cost>
+inline void ReleaseMemory(BasicWorkspace<Cost> &workspace) {
+  BasicWorkspace<Cost> empty;
+  empty.executor = std::move(workspace.executor);
+  empty.columns_per_job = workspace.columns_per_job;
+  empty.split_components = workspace.split_components;
+  empty.deterministic = workspace.deterministic;
+  workspace = std::move(empty);
+}
+
+// Same as above but for the workspace of `OptimizeBatch`.
+template <typename Cost>
+inline void ReleaseMemory(BasicBatchWorkspace<Cost> &workspace) {
+  BasicBatchWorkspace<Cost> empty;
+  empty.executor = std::move(workspace.executor);
+  empty.num_workers = workspace.num_workers;
+  empty.deterministic = workspace.deterministic;
+  workspace = std::move(empty);
+}
+
+namespace internal {
+
+// Solves the problems packed in `ws.arena`. `load(i, slice)` fills the slice
+// of problem i right before it's solved. Results are written to `assignments`
+// - the ones of problem i are [offsets[i], offsets[i + 1]). The remaining
+// arguments are passed to `OptimizeInPlace`.
+//
+// Each worker takes the biggest problem that's left so the workers that got
+// small problems keep taking over the remaining work.
+template <typename Cost, typename Load>
+inline void SolveBatch(int num_problems, Load &&load,
+                       std::vector<BasicAssignment<Cost>> &assignments,
+                       std::vector<int> &offsets, BasicBatchWorkspace<Cost> &ws,
+                       Cost unassigned_cost = 0, bool split = true) {
+  const auto &start = ws.start;
+  auto &order = ws.order;
+  auto &kept = ws.kept;
+  order.resize(num_problems);
+  for (int i = 0; i < num_problems; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return start[a + 1] - start[a] > start[b + 1] - start[b];
+  });
+  kept.assign(num_problems, 0);
+  int num_workers = 1;
+  if (ws.executor) {
+    num_workers = std::clamp(ws.num_workers, 1, std::max(num_problems, 1));
+  }
+  if ((int)ws.workers.size() < num_workers) {
+    ws.workers.resize(num_workers);
+  }
+  std::atomic<int> next = 0;
+  std::atomic<bool> optimal = true;
+  auto work = [&](int worker) {
+    BasicWorkspace<Cost> &worker_ws = ws.workers[worker];
+    worker_ws.deadline = ws.deadline;
+    worker_ws.deterministic = ws.deterministic;
+    for (int k; (k = next.fetch_add(1)) < num_problems;) {
+      int i = order[k];
+      std::span<BasicAssignment<Cost>> slice(ws.arena.data() + start[i],
+                                             start[i + 1] - start[i]);
+      load(i, slice);
+      kept[i] = OptimizeInPlace(slice, worker_ws, unassigned_cost, split);
+      if (!worker_ws.optimal) {
+        optimal = false;
+      }
+    }
+  };
+  if (num_workers == 1) {
+    work(0);
+  } else {
+    ws.executor(num_workers, work);
+  }
+  ws.optimal = optimal;
+
+  offsets.resize(num_problems + 1);
+  offsets[0] = 0;
+  for (int i = 0; i < num_problems; ++i) {
+    offsets[i + 1] = offsets[i] + kept[i];
+  }
+  assignments.resize(offsets[num_problems]);
+  for (int i = 0; i < num_problems; ++i) {
+    std::copy_n(ws.arena.begin() + start[i], kept[i],
+                assignments.begin() + offsets[i]);
+  }
+}
+
+// Solves each connected component of the graph of `assignments` separately.
+// Expects compact ids. Returns -1 when the graph is connected (or dense - then
+// it almost always is). Otherwise passes the optimal assignments to
+// `emit(i, assignment)` (in order of i) & returns their number.
+//
+// Components don't share any vertices so their optimal matchings add up to an
+// optimal matching of the whole graph. Each one gets its own (small) cost
+// matrix with indices local to the component. Missing pairs are worth as much
+// as the most expensive assignment of the whole problem - same as in its
+// matrix - so the results match the solve of the whole problem.
+template <typename Cost, typename Rows, typename Emit>
+inline int SolveComponents(const Rows &assignments, BasicWorkspace<Cost> &ws,
+                           Cost unassigned_cost, Emit &&emit) {
+  COLONY_PHASE(ws, kSolveComponents);
+  int num_characters = 0, num_tasks = 0;
+  Cost max_cost = unassigned_cost;
+  size_t E = assignments.size();
+  for (size_t i = 0; i < E; ++i) {
+    auto &&a = assignments[i];
+    num_characters = std::max(num_characters, a.character + 1);
+    num_tasks = std::max(num_tasks, a.task + 1);
+    if (IsPossible(a.cost)) {
+      max_cost = std::max(max_cost, a.cost);
+    }
+  }
+  if (2 * E > (size_t)num_characters * num_tasks) {
+    return -1;
+  }
+
+  // Union-find over characters [0, num_characters) followed by the tasks.
+  // Roots are the smallest vertices of their sets.
+  int V = num_characters + num_tasks;
+  auto &parent = ws.component_parent;
+  parent.resize(V);
+  for (int v = 0; v < V; ++v) {
+    parent[v] = v;
+  }
+  auto find = [&](int v) {
+    while (parent[v] != v) {
+      v = parent[v] = parent[parent[v]];
+    }
+    return v;
+  };
+  auto &component = ws.component;
+  component.assign(V, -1);
+  // Impossible pairs don't connect anything.
+  for (size_t i = 0; i < E; ++i) {
+    auto &&a = assignments[i];
+    if (!IsPossible(a.cost)) {
+      continue;
+    }
+    int u = a.character, v = num_characters + a.task;
+    component[u] = component[v] = 0; // vertex has some edges
+    u = find(u);
+    v = find(v);
+    parent[std::max(u, v)] = std::min(u, v);
+  }
+
+  // Components are numbered in the order of their roots.
+  int num_components = 0;
+  for (int v = 0; v < V; ++v) {
+    if (component[v] != -1) {
+      int root = find(v);
+      component[v] = root == v ? num_components++ : component[root];
+    }
+  }
+  if (num_components < 2) {
+    return -1;
+  }
+
+  // Vertices of each component - characters first, then tasks.
+  auto &start = ws.component_start;
+  auto &characters = ws.component_characters;
+  start.assign(num_components + 1, 0);
+  characters.assign(num_components, 0);
+  for (int v = 0; v < V; ++v) {
+    if (component[v] != -1) {
+      ++start[component[v] + 1];
+      characters[component[v]] += v < num_characters;
+    }
+  }
+  for (int k = 0; k < num_components; ++k) {
+    start[k + 1] += start[k];
+  }
+  auto &vertices = ws.component_vertices;
+  auto &index = ws.component_index;
+  auto &placed = ws.group_size; // vertices (then edges) placed in each one
+  vertices.resize(start[num_components]);
+  index.resize(V);
+  placed.assign(num_components, 0);
+  for (int v = 0; v < V; ++v) {
+    if (int k = component[v]; k != -1) {
+      int i = placed[k]++;
+      vertices[start[k] + i] = v;
+      index[v] = v < num_characters ? i : i - characters[k];
+    }
+  }
+
+  // Edges of each component with local indices of their vertices.
+  if (!ws.components) {
+    ws.components = std::make_unique<BasicBatchWorkspace<Cost>>();
+  }
+  auto &batch = *ws.components;
+  batch.executor = ws.executor;
+  batch.deadline = ws.deadline;
+  batch.deterministic = ws.deterministic;
+  batch.start.assign(num_components + 1, 0);
+  for (size_t i = 0; i < E; ++i) {
+    if (IsPossible(assignments[i].cost)) {
+      ++batch.start[component[assignments[i].character] + 1];
+    }
+  }
+  for (int k = 0; k < num_components; ++k) {
+    batch.start[k + 1] += batch.start[k];
+  }
+  batch.arena.resize(batch.start[num_components]);
+  placed.assign(batch.start.begin(), batch.start.end() - 1);
+  for (size_t i = 0; i < E; ++i) {
+    auto &&a = assignments[i];
+    if (!IsPossible(a.cost)) {
+      continue;
+    }
+    auto &b = batch.arena[placed[component[a.character]]++];
+    b.character = index[a.character];
+    b.task = index[num_characters + a.task];
+    b.cost = a.cost;
+  }
+
+  auto &results = ws.scratch;
+  auto &offsets = ws.group_start;
+  SolveBatch(
+      num_components, [](int, std::span<BasicAssignment<Cost>>) {}, results,
+      offsets, batch, max_cost, false);
+  ws.optimal = batch.optimal;
+#ifdef COLONY_STATS
+  for (auto &worker : batch.workers) {
+    ws.stats += worker.stats;
+    worker.stats = {};
+  }
+#endif
+  int n = 0;
+  for (int k = 0; k < num_components; ++k) {
+    const int *ids = vertices.data() + start[k];
+    for (int i = offsets[k]; i < offsets[k + 1]; ++i) {
+      emit(n++, BasicAssignment<Cost>{
+                    ids[results[i].character],
+                    ids[characters[k] + results[i].task] - num_characters,
+                    results[i].cost});
+    }
+  }
+  return n;
+}
+
+} // namespace internal
+
+// Solves many independent assignment problems (for example separate colonies)
+// in a single call. Works like calling `Optimize` on each of them.
+//
+// The problems are copied into a shared arena & spread across the workers of
+// `workspace`. Optimal assignments of all problems are written to
+// `assignments` - the ones of problem i are [offsets[i], offsets[i + 1]).
+template <typename Cost>
+inline void OptimizeBatch(
+    std::type_identity_t<std::span<const BasicProblem<Cost>>> problems,
+    std::vector<BasicAssignment<Cost>> &assignments, std::vector<int> &offsets,
+    BasicBatchWorkspace<Cost> &workspace) {
+  int num_problems = problems.size();
+  auto &start = workspace.start;
+  start.resize(num_problems + 1);
+  start[0] = 0;
+  for (int i = 0; i < num_problems; ++i) {
+    start[i + 1] = start[i] + problems[i].assignments.size();
+  }
+  workspace.arena.resize(start[num_problems]);
+  internal::SolveBatch(
+      num_problems,
+      [&](int i, std::span<BasicAssignment<Cost>> slice) {
+        std::copy(problems[i].assignments.begin(),
+                  problems[i].assignments.end(), slice.begin());
+      },
+      assignments, offsets, workspace);
+}
+
+// Variant of `OptimizeBatch` that takes the problems from a flat buffer.
+// Potential assignments of problem i are [offsets[i], offsets[i + 1]) of
+// `assignments`. Both vectors are replaced with the results.
+template <typename Cost>
+inline void OptimizeBatch(std::vector<BasicAssignment<Cost>> &assignments,
+                          std::vector<int> &offsets,
+                          BasicBatchWorkspace<Cost> &workspace) {
+  int num_problems = offsets.empty() ? 0 : offsets.size() - 1;
+  workspace.arena.swap(assignments);
+  workspace.start.assign(offsets.begin(), offsets.end());
+  internal::SolveBatch(
+      num_problems, [](int, std::span<BasicAssignment<Cost>>) {}, assignments,
+      offsets, workspace);
+}
+
+// Single delivery planned by `OptimizeHauling`.
+struct Haul {
+  CharacterId character;
+  int item;
+  int destination;
+  double cost; // cost of picking up the item & delivering it
+};
+
+// Memory used by `OptimizeHauling`. Keep it across frames - each stage keeps
+// its own labels & matching so that both can warm-start on the next frame.
+struct HaulingWorkspace {
+  Workspace deliveries; // items -> destinations
+  Workspace haulers;    // characters -> deliveries
+  std::vector<Assignment> delivery; // result of the first stage
+  std::vector<Assignment> hauler;   // result of the second stage
+};
+
+// Hauling (see the "Hauling & delivery" section at the top) in a single call.
+//
+// First assigns items to destinations using `delivery_cost(item,
+// destination)`. Each matched pair becomes a delivery task. Then assigns
+// characters to delivery tasks. The cost of a delivery for a character is
+// `pickup_cost(character, item)` plus the cost of the matched pair from the
+// first stage - it's read straight from the first stage so no intermediate
+// list of potential assignments is built.
+//
+// Items are [0, num_items), destinations [0, num_destinations) and characters
+// [0, num_characters). Impossible pairs should have infinite cost. The
+// deliveries assigned to characters are written to `hauls`.
+template <typename DeliveryCostFn, typename PickupCostFn>
+inline void OptimizeHauling(int num_items, int num_destinations,
+                            int num_characters,
+                            DeliveryCostFn &&delivery_cost,
+                            PickupCostFn &&pickup_cost,
+                            std::vector<Haul> &hauls,
+                            HaulingWorkspace &workspace) {
+  auto &delivery = workspace.delivery;
+  Reoptimize(num_items, num_destinations, delivery_cost, delivery,
+             workspace.deliveries);
+  auto hauler_cost = [&](CharacterId c, TaskId d) {
+    return pickup_cost(c, delivery[d].character) + delivery[d].cost;
+  };
+  Reoptimize(num_characters, (int)delivery.size(), hauler_cost,
+             workspace.hauler, workspace.haulers);
+  hauls.clear();
+  for (auto &a : workspace.hauler) {
+    hauls.push_back(Haul{a.character, delivery[a.task].character,
+                         delivery[a.task].task, a.cost});
+  }
+}
+
+// Zone of a position on a grid of square cells (see `OptimizeZones`). Grids
+// with more than 32768 cells along an axis wrap around. Zones are never
+// negative. Bad input (NaN, infinite coordinates or a `cell_size` that isn't
+// positive) can't overflow - NaN lands in the cell 0 & the cells are clamped
+// to +-2^30.
+inline int GridZone(double x, double y, double cell_size) {
+  auto cell = [&](double coordinate) {
+    const double kMaxCell = 1 << 30;
+    double cell = std::floor(coordinate / cell_size);
+    if (std::isnan(cell)) {
+      return 0;
+    }
+    return (int)std::clamp(cell, -kMaxCell, kMaxCell) & 0x7fff;
+  };
+  return cell(x) << 15 | cell(y);
+}
+
+// Zone of the tasks without a label (see `OptimizeZones`). Negative so that it
+// doesn't merge with any cell of `GridZone`.
+constexpr int kNoZone = std::numeric_limits<int>::min();
+
+// Memory used by `OptimizeZones`. Keep it across frames - zones whose
+// potential assignments didn't change reuse their previous results.
+struct ZoneWorkspace {
+  // Solves the zones. Set its `executor` to solve them in parallel.
+  BatchWorkspace zones;
+  Workspace top; // characters -> zones
+
+  // Whether `OptimizeZones` should also solve the whole problem at once & set
+  // `gap`. Meant for tuning the zones - it's as slow as not using them.
+  bool measure_gap = false;
+  Workspace full;
+  std::vector<Assignment> full_result; // result of the whole problem
+
+  // Report of the last call.
+  int num_zones = 0;    // zones with any tasks
+  int solved_zones = 0; // zones that had to be solved again
+  double gap = 0;       // cost of using zones (see `measure_gap`)
+
+  IdMap<int> zone_ids; // indices of the zone labels
+  IdMap<CharacterId> character_ids;   // indices of sparse character ids
+  IdMap<TaskId> zoneless_tasks;       // tasks past the end of `task_zone`
+  std::vector<int> character;         // index of the character of each row
+  double last_max_cost = 0;           // cost of a missing assignment
+  std::vector<char> seen;             // zones & tasks of the current call
+  std::vector<int> zone_tasks;        // number of tasks in each zone
+  std::vector<int> last_zone_tasks;   // `zone_tasks` of the last call
+  std::vector<int> character_start;   // assignments grouped by character
+  std::vector<int> order;             // ...
+  std::vector<int> next;              // ...
+  std::vector<int> zone_stamp;        // last character that reached a zone
+  std::vector<Assignment> top_input;  // cheapest assignment to each zone
+  std::vector<Assignment> last_top_input; // `top_input` of the last call
+  std::vector<Assignment> top_result;     // zone picked by each character
+  std::vector<int> target;            // zone of each character (-1 none)
+  std::vector<std::vector<Assignment>> zone_input;  // last input of each zone
+  std::vector<std::vector<Assignment>> zone_result; // last result of each one
+  std::vector<std::vector<Assignment>> next_input;  // input of this call
+  std::vector<Assignment> batch;  // zones that changed, packed together
+  std::vector<int> batch_offsets; // zone i is [offsets[i], offsets[i + 1])
+  std::vector<int> batch_zones;   // zone of each problem in `batch`
+  std::vector<int> grid_zone;     // zone of each task (grid variant)
+};
+
+// Coarse-to-fine version of `Optimize` for huge maps.
+//
+// Tasks are grouped into zones (rooms, islands or cells of `GridZone`) - task
+// `t` belongs to the zone labeled `task_zone[t]`. Tasks past the end of the
+// span (or with negative ids) share the zone labeled `kNoZone`. Impossible
+// pairs are skipped & character ids can be sparse. First a small top-level
+// problem sends every character to one zone: a character can go to any zone
+// where it has potential assignments, for the cost of the cheapest one, & no
+// zone gets more characters than it has tasks. Then each zone is solved on its
+// own (in parallel if `workspace.zones` has an `executor`). Zones whose
+// potential assignments didn't change since the last call reuse their previous
+// results, so scenes where only a few characters move solve only a few zones.
+//
+// The result is a valid assignment but not necessarily an optimal one - a
+// character sent to a zone can't take the tasks of the neighboring zones. Set
+// `workspace.measure_gap` to find out how much it costs: `workspace.gap` is
+// then set to the total cost of the result minus the total cost of `Optimize`
+// (where a missing assignment costs as much as the most expensive one).
+inline void OptimizeZones(std::vector<Assignment> &assignments,
+                          std::span<const int> task_zone,
+                          ZoneWorkspace &workspace) {
+  ZoneWorkspace &ws = workspace;
+  std::erase_if(assignments,
+                [](auto &a) { return !internal::IsPossible(a.cost); });
+  CharacterId min_character = 0, max_character = 0;
+  double max_cost = 0;
+  for (auto &a : assignments) {
+    min_character = std::min(min_character, a.character);
+    max_character = std::max(max_character, a.character);
+    max_cost = std::max(max_cost, a.cost);
+  }
+  // Characters index the arrays below. Sparse ones get dense indices.
+  size_t n = assignments.size();
+  bool compact = min_character < 0 || max_character > 2.0 * n + 1024;
+  ws.character.resize(n);
+  ws.character_ids.Clear();
+  for (size_t i = 0; i < n; ++i) {
+    CharacterId c = assignments[i].character;
+    ws.character[i] = compact ? ws.character_ids.Insert(c) : c;
+  }
+  int num_characters =
+      compact ? ws.character_ids.Capacity() : (n ? max_character + 1 : 0);
+  auto zone_label = [&](TaskId t) {
+    return (size_t)t < task_zone.size() ? task_zone[t] : kNoZone;
+  };
+
+  // Register the zones & count their tasks. Zones that are gone forget their
+  // results. So do all of them when the cost of a missing assignment changes.
+  if (max_cost != ws.last_max_cost) {
+    ws.last_max_cost = max_cost;
+    for (auto &input : ws.zone_input) {
+      input.clear();
+    }
+    for (auto &result : ws.zone_result) {
+      result.clear();
+    }
+  }
+  ws.seen.assign(task_zone.size(), false);
+  ws.zoneless_tasks.Clear();
+  for (auto &a : assignments) {
+    ws.zone_ids.Insert(zone_label(a.task));
+  }
+  int num_zones = ws.zone_ids.Capacity();
+  ws.zone_tasks.assign(num_zones, 0);
+  for (auto &a : assignments) {
+    bool first;
+    if ((size_t)a.task < task_zone.size()) {
+      first = !ws.seen[a.task];
+      ws.seen[a.task] = true;
+    } else {
+      int size = ws.zoneless_tasks.Size();
+      ws.zoneless_tasks.Insert(a.task);
+      first = ws.zoneless_tasks.Size() > size;
+    }
+    if (first) {
+      ++ws.zone_tasks[ws.zone_ids.Find(zone_label(a.task))];
+    }
+  }
+  ws.zone_input.resize(num_zones);
+  ws.zone_result.resize(num_zones);
+  ws.next_input.resize(num_zones);
+  for (int z = 0; z < num_zones; ++z) {
+    if (ws.zone_tasks[z] == 0 && ws.zone_ids.IsLive(z)) {
+      ws.zone_ids.Remove(ws.zone_ids[z]);
+      ws.zone_input[z].clear();
+      ws.zone_result[z].clear();
+    }
+  }
+  ws.num_zones = ws.zone_ids.Size();
+  auto zone_of = [&](TaskId t) { return ws.zone_ids.Find(zone_label(t)); };
+
+  // Top level - the cheapest assignment of each character to each zone.
+  // Counting sort of the assignments by character.
+  auto &start = ws.character_start;
+  start.assign(num_characters + 1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    ++start[ws.character[i] + 1];
+  }
+  for (int c = 0; c < num_characters; ++c) {
+    start[c + 1] += start[c];
+  }
+  ws.order.resize(n);
+  ws.next.assign(start.begin(), start.end() - 1);
+  for (size_t i = 0; i < n; ++i) {
+    ws.order[ws.next[ws.character[i]]++] = i;
+  }
+  ws.top_input.clear();
+  ws.zone_stamp.assign(num_zones, -1); // index in `top_input` of its character
+  for (int c = 0; c < num_characters; ++c) {
+    int first = ws.top_input.size();
+    for (int k = start[c]; k < start[c + 1]; ++k) {
+      const Assignment &a = assignments[ws.order[k]];
+      int z = zone_of(a.task);
+      int &i = ws.zone_stamp[z];
+      // Costs are shifted so that leaving a character without a zone costs
+      // as much as the most expensive assignment of the whole problem.
+      double cost = a.cost - max_cost;
+      if (i < first) {
+        i = ws.top_input.size();
+        ws.top_input.push_back({c, z, cost});
+      } else {
+        ws.top_input[i].cost = std::min(ws.top_input[i].cost, cost);
+      }
+    }
+  }
+  auto same = [](const std::vector<Assignment> &a,
+                 const std::vector<Assignment> &b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](auto &x, auto &y) {
+             return x.character == y.character && x.task == y.task &&
+                    x.cost == y.cost;
+           });
+  };
+  if (!same(ws.top_input, ws.last_top_input) ||
+      ws.zone_tasks != ws.last_zone_tasks) {
+    ws.last_top_input = ws.top_input;
+    ws.last_zone_tasks = ws.zone_tasks;
+    ws.top_result = ws.top_input;
+    OptimizeCapacitated<double>(ws.top_result, {}, ws.zone_tasks, ws.top);
+  }
+  ws.target.assign(num_characters, -1);
+  for (auto &a : ws.top_result) {
+    ws.target[a.character] = a.task;
+  }
+
+  // Bottom level - characters & tasks of each zone. Zones solved in the last
+  // call with the same input keep their results.
+  for (auto &input : ws.next_input) {
+    input.clear();
+  }
+  for (size_t i = 0; i < n; ++i) {
+    auto &a = assignments[i];
+    int z = zone_of(a.task);
+    if (ws.target[ws.character[i]] == z) {
+      ws.next_input[z].push_back(a);
+    }
+  }
+  ws.batch.clear();
+  ws.batch_offsets.assign(1, 0);
+  ws.batch_zones.clear();
+  for (int z = 0; z < num_zones; ++z) {
+    if (same(ws.next_input[z], ws.zone_input[z])) {
+      continue;
+    }
+    ws.zone_input[z].swap(ws.next_input[z]);
+    auto &input = ws.zone_input[z];
+    ws.batch.insert(ws.batch.end(), input.begin(), input.end());
+    ws.batch_offsets.push_back(ws.batch.size());
+    ws.batch_zones.push_back(z);
+  }
+  // Same as the flat `OptimizeBatch` but zones share the cost of leaving a
+  // character unassigned.
+  ws.solved_zones = ws.batch_zones.size();
+  ws.zones.arena.swap(ws.batch);
+  ws.zones.start.assign(ws.batch_offsets.begin(), ws.batch_offsets.end());
+  internal::SolveBatch<double>(
+      ws.solved_zones, [](int, std::span<Assignment>) {}, ws.batch,
+      ws.batch_offsets, ws.zones, max_cost);
+  for (int i = 0; i < ws.solved_zones; ++i) {
+    ws.zone_result[ws.batch_zones[i]].assign(
+        ws.batch.begin() + ws.batch_offsets[i],
+        ws.batch.begin() + ws.batch_offsets[i + 1]);
+  }
+
+  auto &full = ws.full_result;
+  if (ws.measure_gap) {
+    full.assign(assignments.begin(), assignments.end());
+    Optimize(full, Engine::Auto, ws.full);
+  }
+  assignments.clear();
+  for (int z = 0; z < num_zones; ++z) {
+    auto &result = ws.zone_result[z];
+    assignments.insert(assignments.end(), result.begin(), result.end());
+  }
+  if (ws.measure_gap) {
+    auto savings = [&](const std::vector<Assignment> &result) {
+      double total = 0;
+      for (auto &a : result) {
+        total += max_cost - a.cost;
+      }
+      return total;
+    };
+    ws.gap = savings(full) - savings(assignments);
+  }
+}
+
+// Same as above but takes the positions of the tasks. Zones are the cells of a
+// grid (see `GridZone`). `task_x[t]` & `task_y[t]` are the position of task t.
+inline void OptimizeZones(std::vector<Assignment> &assignments,
+                          std::span<const double> task_x,
+                          std::span<const double> task_y, double cell_size,
+                          ZoneWorkspace &workspace) {
+  auto &zone = workspace.grid_zone;
+  zone.resize(std::min(task_x.size(), task_y.size()));
+  for (size_t t = 0; t < zone.size(); ++t) {
+    zone[t] = GridZone(task_x[t], task_y[t], cell_size);
+  }
+  OptimizeZones(assignments, zone, workspace);
+}
+
+// Long-term planning (see the "Long-term planning" section at the top).
+//
+// Assigns tasks to characters, then repeatedly marks the task that would be
+// completed first as done, moves its character (virtually) to that task and
+// assigns the tasks again. Each repetition changes the costs of one character
+// & removes one task so the solver is warm-started from the previous
+// assignment.
+//
+// `cost(character, after_task, task)` should return the cost of doing `task`
+// right after finishing `after_task` (-1 means starting from the current state
+// of the character). Impossible tasks should have infinite cost. Characters are
+// [0, num_characters), tasks are [0, num_tasks).
+//
+// Planning stops when `budget_us` microseconds pass, when there are no tasks
+// left or when all characters have `max_depth` tasks planned. Tasks planned for
+// character `c` (in order of execution) are written to `plans[c]`. The last
+// task of each plan comes from the final assignment. The budget also bounds
+// the solves - when it runs out in the middle of one, the final assignment is
+// completed greedily.
+template <typename CostFn>
+inline void PlanAhead(int num_characters, int num_tasks, CostFn &&cost,
+                      double budget_us, int max_depth,
+                      std::vector<std::vector<TaskId>> &plans,
+                      Workspace &workspace) {
+  using Clock = std::chrono::steady_clock;
+  auto deadline =
+      Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                         std::chrono::duration<double, std::micro>(budget_us));
+  Workspace &ws = workspace;
+  const double inf = std::numeric_limits<double>::infinity();
+  plans.resize(num_characters);
+  for (auto &plan : plans) {
+    plan.clear();
+  }
+  if (max_depth <= 0) {
+    return;
+  }
+
+  // Total cost of finishing the current plan of a character & then doing the
+  // task. Tasks that are already done are impossible.
+  auto &total = ws.plan_cost;
+  auto &busy_until = ws.busy_until;
+  auto &last_task = ws.last_task;
+  total.resize((size_t)num_characters * num_tasks);
+  busy_until.assign(num_characters, 0);
+  last_task.assign(num_characters, -1);
+  double U = 0; // cost of leaving a character unassigned
+  for (CharacterId c = 0; c < num_characters; ++c) {
+    for (TaskId t = 0; t < num_tasks; ++t) {
+      double &tc = total[(size_t)c * num_tasks + t];
+      tc = cost(c, -1, t);
+      if (tc < inf) {
+        U = std::max(U, tc);
+      }
+    }
+  }
+  auto total_cost = [&](CharacterId c, TaskId t) {
+    return total[(size_t)c * num_tasks + t];
+  };
+  int NX, NY;
+  internal::FillDense(num_characters, num_tasks, total_cost, ws, NX, NY,
+                      ws.transpose);
+  ws.compact = false;
+  // Solves are also bounded by the deadline. When one of them doesn't finish,
+  // planning stops & the final assignment is completed greedily.
+  Deadline old_deadline = std::exchange(ws.deadline, deadline);
+  internal::SolveDense(ws, NX, NY);
+
+  // Keeps `ws.value` in sync with `total` & marks the affected rows.
+  auto set_value = [&](CharacterId c, TaskId t) {
+    double tc = total_cost(c, t);
+    int x = ws.transpose ? t : c, y = ws.transpose ? c : t;
+    ws.value[(size_t)x * NY + y] = tc < inf ? -tc : -U;
+  };
+  auto mark_character = [&](CharacterId c) {
+    if (ws.transpose)
+      internal::MarkColumnDirty(ws, c);
+    else
+      ws.dirty_x.push_back(c);
+  };
+  auto mark_task = [&](TaskId t) {
+    if (ws.transpose)
+      ws.dirty_x.push_back(t);
+    else
+      internal::MarkColumnDirty(ws, t);
+  };
+
+  while (ws.optimal && Clock::now() < deadline) {
+    // Find the assignment that would be completed first.
+    CharacterId best_c = -1;
+    TaskId best_t = -1;
+    for (int x = 0; x < NX; ++x) {
+      CharacterId c = ws.transpose ? ws.xy[x] : x;
+      TaskId t = ws.transpose ? x : ws.xy[x];
+      if (total_cost(c, t) == inf || (int)plans[c].size() + 1 >= max_depth)
+        continue;
+      if (best_c == -1 || total_cost(c, t) < total_cost(best_c, best_t)) {
+        best_c = c;
+        best_t = t;
+      }
+    }
+    if (best_c == -1)
+      break;
+
+    // Complete it & update the costs.
+    plans[best_c].push_back(best_t);
+    busy_until[best_c] = total_cost(best_c, best_t);
+    last_task[best_c] = best_t;
+    ws.dirty_x.clear();
+    for (CharacterId c = 0; c < num_characters; ++c) {
+      total[(size_t)c * num_tasks + best_t] = inf;
+      set_value(c, best_t);
+    }
+    mark_task(best_t);
+    double old_U = U;
+    for (TaskId t = 0; t < num_tasks; ++t) {
+      double &tc = total[(size_t)best_c * num_tasks + t];
+      if (tc == inf)
+        continue;
+      tc = busy_until[best_c] + cost(best_c, best_t, t);
+      if (tc < inf)
+        U = std::max(U, tc);
+    }
+    if (U != old_U) {
+      // Leaving characters unassigned got more expensive. This changes the
+      // value of all the missing pairs.
+      ws.max_cost = U;
+      ws.dirty_x.clear();
+      for (CharacterId c = 0; c < num_characters; ++c)
+        for (TaskId t = 0; t < num_tasks; ++t)
+          set_value(c, t);
+      for (int x = 0; x < NX; ++x)
+        ws.dirty_x.push_back(x);
+    } else {
+      for (TaskId t = 0; t < num_tasks; ++t)
+        set_value(best_c, t);
+      mark_character(best_c);
+    }
+    internal::RepairRows(ws, NX, NY);
+    internal::AugmentDense(ws, NX, NY);
+  }
+
+  // Append the final assignment.
+  internal::EmitMatching(ws, [&] {
+    for (int x = 0; x < NX; ++x) {
+      CharacterId c = ws.transpose ? ws.xy[x] : x;
+      TaskId t = ws.transpose ? x : ws.xy[x];
+      if (total_cost(c, t) < inf)
+        plans[c].push_back(t);
+    }
+    return 0;
+  });
+  ws.deadline = old_deadline;
+}
+
+// Same as above but returns the plans & uses the `DefaultWorkspace()` of the
+// calling thread.
+template <typename CostFn>
+inline std::vector<std::vector<TaskId>>
+PlanAhead(int num_characters, int num_tasks, CostFn &&cost, double budget_us,
+          int max_depth) {
+  std::vector<std::vector<TaskId>> plans;
+  PlanAhead(num_characters, num_tasks, cost, budget_us, max_depth, plans,
+            DefaultWorkspace());
+  return plans;
+}
+
+// Metrics supported by `SpatialCandidates`.
+enum class Distance { Euclidean, Chebyshev, Manhattan };
+
+// Spatial index of task positions. Generates potential assignments between
+// characters and their nearest tasks.
+//
+// In most games the cost of a task is dominated by the travel time. Instead of
+// computing the costs of all character-task pairs (and then throwing most of
+// them away with `LimitAssignments`) only the k nearest tasks of each character
+// can be considered. Tasks marked as "forced" (for example vital tasks with
+// high priority) are considered by all characters, no matter the distance.
+//
+// Tasks are kept in a uniform grid of square cells. Tasks can be inserted,
+// moved & removed in O(1) as they spawn and complete. The results are best
+// passed to `OptimizeSparse`.
+class SpatialCandidates {
+public:
+  explicit SpatialCandidates(double cell_size = 16,
+                             Distance distance = Distance::Euclidean)
+      : cell_size_(cell_size), distance_(distance) {}
+
+  // Inserts a new task or moves an existing one.
+  void Insert(TaskId task, double x, double y) {
+    int64_t key = CellKey(CellOf(x), CellOf(y));
+    auto [it, inserted] = tasks_.try_emplace(task);
+    Location &location = it->second;
+    if (!inserted) {
+      if (location.key == key) {
+        auto &item = cells_[key][location.slot];
+        item.x = x;
+        item.y = y;
+        return;
+      }
+      Unlink(location);
+    }
+    auto &cell = cells_[key];
+    location.key = key;
+    location.slot = cell.size();
+    cell.push_back(Item{task, x, y});
+    min_cx_ = std::min(min_cx_, CellOf(x));
+    max_cx_ = std::max(max_cx_, CellOf(x));
+    min_cy_ = std::min(min_cy_, CellOf(y));
+    max_cy_ = std::max(max_cy_, CellOf(y));
+  }
+
+  // Removes the task (if present).
+  void Remove(TaskId task) {
+    auto it = tasks_.find(task);
+    if (it == tasks_.end()) {
+      return;
+    }
+    Unlink(it->second);
+    SetForced(task, false);
+    tasks_.erase(it);
+  }
+
+  // Forced tasks are candidates for every character.
+  void SetForced(TaskId task, bool forced) {
+    auto it = std::find(forced_.begin(), forced_.end(), task);
+    if (forced && it == forced_.end()) {
+      forced_.push_back(task);
+    } else if (!forced && it != forced_.end()) {
+      *it = forced_.back();
+      forced_.pop_back();
+    }
+  }
+
+  // Number of tasks in the index.
+  int Size() const { return tasks_.size(); }
+
+  // Distance between two points according to the metric of this index.
+  double DistanceBetween(double x1, double y1, double x2, double y2) const {
+    double dx = std::abs(x1 - x2), dy = std::abs(y1 - y2);
+    switch (distance_) {
+    case Distance::Chebyshev:
+      return std::max(dx, dy);
+    case Distance::Manhattan:
+      return dx + dy;
+    default:
+      return std::sqrt(dx * dx + dy * dy);
+    }
+  }
+
+  // Finds (at most) `k` tasks nearest to (x, y). They are written to `nearest`
+  // as (distance, task) pairs, sorted by distance (ties broken by task id).
+  void Nearest(double x, double y, int k,
+               std::vector<std::pair<double, TaskId>> &nearest) const {
+    nearest.clear();
+    k = std::min(k, Size());
+    if (k <= 0) {
+      return;
+    }
+    int cx = CellOf(x), cy = CellOf(y);
+    // Distance from (x, y) to the border of its own cell.
+    double fx = x - cx * cell_size_, fy = y - cy * cell_size_;
+    double margin =
+        std::min(std::min(fx, cell_size_ - fx), std::min(fy, cell_size_ - fy));
+    // `nearest` is kept as a max-heap of the best candidates so far.
+    auto consider = [&](const std::vector<Item> &cell) {
+      for (const Item &item : cell) {
+        std::pair<double, TaskId> candidate(
+            DistanceBetween(x, y, item.x, item.y), item.task);
+        if ((int)nearest.size() < k) {
+          nearest.push_back(candidate);
+          std::push_heap(nearest.begin(), nearest.end());
+        } else if (candidate < nearest.front()) {
+          std::pop_heap(nearest.begin(), nearest.end());
+          nearest.back() = candidate;
+          std::push_heap(nearest.begin(), nearest.end());
+        }
+      }
+    };
+    auto visit = [&](int cell_x, int cell_y) {
+      auto it = cells_.find(CellKey(cell_x, cell_y));
+      if (it != cells_.end()) {
+        consider(it->second);
+      }
+    };
+    // Number of cell lookups so far.
+    size_t lookups = 0;
+    for (int r = 0;; ++r) {
+      // All of the tasks in rings >= r are at least this far away (every
+      // metric is at least as large as the Chebyshev distance). The worst
+      // candidate is compared as a (distance, id) pair so that a task at
+      // exactly `bound` with a smaller id is still found.
+      double bound = r == 0 ? 0 : (r - 1) * cell_size_ + margin;
+      if ((int)nearest.size() == k &&
+          nearest.front() < std::pair(bound, kMinTask)) {
+        break;
+      }
+      if (cx - r < min_cx_ && cx + r > max_cx_ && cy - r < min_cy_ &&
+          cy + r > max_cy_) {
+        break; // the ring is outside of all tasks
+      }
+      if (r == 0) {
+        visit(cx, cy);
+        continue;
+      }
+      if (lookups >= cells_.size()) {
+        // The tasks are sparse - scanning the remaining cells directly is
+        // cheaper than walking more (mostly empty) rings.
+        for (auto &[key, cell] : cells_) {
+          int64_t dx = std::abs((int64_t)(int32_t)(key >> 32) - cx);
+          int64_t dy = std::abs((int64_t)(int32_t)key - cy);
+          if (std::max(dx, dy) >= r) {
+            consider(cell);
+          }
+        }
+        break;
+      }
+      // Visit the ring of cells at distance r, clipped to the occupied area.
+      int x0 = std::max(cx - r, min_cx_), x1 = std::min(cx + r, max_cx_);
+      int y0 = std::max(cy - r + 1, min_cy_);
+      int y1 = std::min(cy + r - 1, max_cy_);
+      lookups += 2 * std::max(x1 - x0 + 1, 0) + 2 * std::max(y1 - y0 + 1, 0);
+      for (int i = x0; i <= x1; ++i) {
+        if (cy - r >= min_cy_)
+          visit(i, cy - r);
+        if (cy + r <= max_cy_)
+          visit(i, cy + r);
+      }
+      for (int j = y0; j <= y1; ++j) {
+        if (cx - r >= min_cx_)
+          visit(cx - r, j);
+        if (cx + r <= max_cx_)
+          visit(cx + r, j);
+      }
+    }
+    std::sort_heap(nearest.begin(), nearest.end());
+  }
+
+  // Appends potential assignments of a `character` standing at (x, y) to its
+  // `k` nearest tasks & all of the forced tasks. Their costs are computed by
+  // `cost(task, distance)`. Assignments with infinite cost are skipped.
+  template <typename CostFn>
+  void Generate(CharacterId character, double x, double y, int k,
+                CostFn &&cost, std::vector<Assignment> &assignments) {
+    Nearest(x, y, k, nearest_);
+    auto add = [&](TaskId task, double distance) {
+      double c = cost(task, distance);
+      if (c < std::numeric_limits<double>::infinity()) {
+        assignments.push_back(Assignment{character, task, c});
+      }
+    };
+    for (auto &[distance, task] : nearest_) {
+      add(task, distance);
+    }
+    for (TaskId task : forced_) {
+      bool is_near = false;
+      for (auto &n : nearest_) {
+        is_near |= n.second == task;
+      }
+      auto it = tasks_.find(task);
+      if (is_near || it == tasks_.end()) {
+        continue;
+      }
+      const Item &item = cells_.find(it->second.key)->second[it->second.slot];
+      add(task, DistanceBetween(x, y, item.x, item.y));
+    }
+  }
+
+private:
+  struct Item {
+    TaskId task;
+    double x, y;
+  };
+  static constexpr double kMaxCell = 1 << 30;
+  static constexpr TaskId kMinTask = std::numeric_limits<TaskId>::min();
+
+  struct Location {
+    int64_t key; // cell of the task
+    int slot;    // index of the task in its cell
+  };
+
+  // Cells are clamped to +-2^30 so that the ring search can't overflow. NaN
+  // lands in the cell 0.
+  int CellOf(double coordinate) const {
+    double cell = std::floor(coordinate / cell_size_);
+    if (std::isnan(cell)) {
+      return 0;
+    }
+    return (int)std::clamp(cell, -kMaxCell, kMaxCell);
+  }
+
+  static int64_t CellKey(int cx, int cy) {
+    return (int64_t)(uint32_t)cx << 32 | (uint32_t)cy;
+  }
+
+  // Removes the task from its cell. Leaves `tasks_` alone.
+  void Unlink(const Location &location) {
+    auto it = cells_.find(location.key);
+    auto &cell = it->second;
+    cell[location.slot] = cell.back();
+    tasks_[cell[location.slot].task].slot = location.slot;
+    cell.pop_back();
+    if (cell.empty()) {
+      cells_.erase(it);
+    }
+  }
+
+  double cell_size_;
+  Distance distance_;
+  std::unordered_map<int64_t, std::vector<Item>> cells_;
+  std::unordered_map<TaskId, Location> tasks_;
+  std::vector<TaskId> forced_;
+  // Bounding box of the occupied cells. Only grows.
+  int min_cx_ = std::numeric_limits<int>::max();
+  int max_cx_ = std::numeric_limits<int>::min();
+  int min_cy_ = std::numeric_limits<int>::max();
+  int max_cy_ = std::numeric_limits<int>::min();
+  std::vector<std::pair<double, TaskId>> nearest_; // buffer for `Generate`
+};
+
+// Stateful alternative to `Reoptimize` for games that report the changes of
+// their characters, tasks & costs as they happen - instead of building the
+// list of potential assignments on every frame.
+//
+// The scheduler keeps the potential assignments, the ids & the state of the
+// dense solver. `Solve` writes only the changed entries of the cost matrix &
+// repairs only the rows touched by the changes since its last call. Like in
+// `Reoptimize` each freed row can cost O(n^2), so a frame with k changes costs
+// O(k * n^2) in the worst case instead of O(n^3) from scratch. Usually the
+// repairs are much cheaper.
+//
+// The cost matrix is rebuilt (and the solver warm-started like in
+// `Reoptimize`) when the ids outgrow it or when the most expensive cost
+// changes - setting `unassigned_cost` to an upper bound of the costs avoids
+// the latter.
+//
+// With a `deterministic` workspace every `Solve` renumbers the ids in sorted
+// order & solves from scratch (O(n^3)). Results are sorted by ids & don't
+// depend on the order of the earlier changes. Characters & tasks without
+// potential assignments are forgotten.
+template <typename Cost> class BasicScheduler {
+public:
+  // Missing pairs cost as much as the most expensive potential assignment or
+  // `unassigned_cost` - whichever is bigger (see `Optimize`).
+  explicit BasicScheduler(Cost unassigned_cost = 0)
+      : unassigned_cost_(unassigned_cost) {}
+
+  void AddCharacter(CharacterId character) {
+    AddId(workspace.character_ids, character_tasks_, character);
+  }
+
+  void AddTask(TaskId task) {
+    AddId(workspace.task_ids, task_characters_, task);
+  }
+
+  // Removes the character together with its potential assignments.
+  void RemoveCharacter(CharacterId character) {
+    int c = workspace.character_ids.Find(character);
+    if (c == -1) {
+      return;
+    }
+    while (!character_tasks_[c].empty()) {
+      Erase(c, character_tasks_[c].back());
+    }
+    workspace.character_ids.Remove(character);
+  }
+
+  // Removes the task together with its potential assignments.
+  void RemoveTask(TaskId task) {
+    int t = workspace.task_ids.Find(task);
+    if (t == -1) {
+      return;
+    }
+    while (!task_characters_[t].empty()) {
+      Erase(task_characters_[t].back(), t);
+    }
+    workspace.task_ids.Remove(task);
+  }
+
+  // Sets the cost of assigning `character` to `task`. Adds the character & the
+  // task if necessary. An infinite cost removes the potential assignment.
+  void UpdateCost(CharacterId character, TaskId task, Cost cost) {
+    if (!(cost < CostTraits<Cost>::Infinity())) {
+      int c = workspace.character_ids.Find(character);
+      int t = workspace.task_ids.Find(task);
+      if (c != -1 && t != -1 && costs_.count(Key(c, t))) {
+        Erase(c, t);
+      }
+      return;
+    }
+    int c = AddId(workspace.character_ids, character_tasks_, character);
+    int t = AddId(workspace.task_ids, task_characters_, task);
+    auto [it, inserted] = costs_.try_emplace(Key(c, t), cost);
+    if (inserted) {
+      character_tasks_[c].push_back(t);
+      task_characters_[t].push_back(c);
+    } else if (it->second == cost) {
+      return;
+    } else {
+      Uncount(it->second);
+      it->second = cost;
+    }
+    ++histogram_[cost];
+    dirty_.emplace_back(c, t);
+  }
+
+  // Returns the optimal assignments of the current characters & tasks (at most
+  // one per character & task). The result stays valid until the next call.
+  const std::vector<BasicAssignment<Cost>> &Solve() {
+    BasicWorkspace<Cost> &ws = workspace;
+    int num_characters = ws.character_ids.Capacity();
+    int num_tasks = ws.task_ids.Capacity();
+    bool fits = ws.warm && ws.compact && MaxCost() == ws.max_cost &&
+                (ws.transpose ? num_tasks : num_characters) <= ws.NX &&
+                (ws.transpose ? num_characters : num_tasks) <= ws.NY;
+    if (ws.deterministic) {
+      Renumber();
+      Rebuild(ws.character_ids.Capacity(), ws.task_ids.Capacity());
+    } else if (fits) {
+      Cost *value = ws.value.data();
+      ws.dirty_x.clear();
+      for (auto [c, t] : dirty_) {
+        int x = ws.transpose ? t : c, y = ws.transpose ? c : t;
+        auto it = costs_.find(Key(c, t));
+        Cost &v = value[(size_t)x * ws.NY + y];
+        v = it == costs_.end() ? -ws.max_cost : -it->second;
+        // Rows stay intact while their labels are feasible & matched edges -
+        // tight.
+        if (v > ws.lx[x] + ws.ly[y] ||
+            (ws.xy[x] == y && !internal::Eq(v, ws.lx[x] + ws.ly[y]))) {
+          ws.dirty_x.push_back(x);
+        }
+      }
+      internal::RepairRows(ws, ws.NX, ws.NY);
+      internal::AugmentDense(ws, ws.NX, ws.NY);
+    } else {
+      Rebuild(num_characters, num_tasks);
+    }
+    dirty_.clear();
+
+    result_.clear();
+    internal::EmitMatching(ws, [&] {
+      for (int x = 0; x < ws.NX; ++x) {
+        int y = ws.xy[x];
+        int c = ws.transpose ? y : x, t = ws.transpose ? x : y;
+        auto it = y == -1 ? costs_.end() : costs_.find(Key(c, t));
+        if (it != costs_.end()) {
+          result_.push_back(BasicAssignment<Cost>{
+              ws.character_ids[c], ws.task_ids[t], it->second});
+        }
+      }
+      return 0;
+    });
+    if (ws.deterministic) {
+      std::sort(result_.begin(), result_.end(), internal::ById<Cost>);
+    }
+    return result_;
+  }
+
+  // Workspace of the solver. Its `executor`, `deadline` & `stats` can be used
+  // as usual & it answers the what-if queries (see `CharacterValue`) about the
+  // last `Solve`. It shouldn't be passed to the other solvers.
+  BasicWorkspace<Cost> workspace;
+
+private:
+  static uint64_t Key(int c, int t) {
+    return (uint64_t)(uint32_t)c << 32 | (uint32_t)t;
+  }
+
+  static int AddId(IdMap<int> &ids, std::vector<std::vector<int>> &neighbors,
+                   int id) {
+    int i = ids.Insert(id);
+    if (i >= (int)neighbors.size()) {
+      neighbors.resize(i + 1);
+    }
+    return i;
+  }
+
+  void Erase(int c, int t) {
+    auto it = costs_.find(Key(c, t));
+    Uncount(it->second);
+    costs_.erase(it);
+    auto unlink = [](std::vector<int> &neighbors, int i) {
+      *std::find(neighbors.begin(), neighbors.end(), i) = neighbors.back();
+      neighbors.pop_back();
+    };
+    unlink(character_tasks_[c], t);
+    unlink(task_characters_[t], c);
+    dirty_.emplace_back(c, t);
+  }
+
+  void Uncount(Cost cost) {
+    auto it = histogram_.find(cost);
+    if (--it->second == 0) {
+      histogram_.erase(it);
+    }
+  }
+
+  Cost MaxCost() const {
+    return histogram_.empty()
+               ? unassigned_cost_
+               : std::max(unassigned_cost_, histogram_.rbegin()->first);
+  }
+
+  // Gives the characters & tasks indices in the order of their ids. Ids
+  // without potential assignments are dropped - like the gaps left by the
+  // removed ones they would change the shape of the matrix.
+  void Renumber() {
+    auto renumber = [](IdMap<int> &ids,
+                       std::vector<std::vector<int>> &neighbors) {
+      std::vector<int> sorted, index(ids.Capacity(), -1);
+      auto used = [&](int i) { return ids.IsLive(i) && !neighbors[i].empty(); };
+      for (int i = 0; i < ids.Capacity(); ++i) {
+        if (used(i)) {
+          sorted.push_back(ids[i]);
+        }
+      }
+      std::sort(sorted.begin(), sorted.end());
+      std::vector<std::vector<int>> old_neighbors(sorted.size());
+      for (int i = 0; i < ids.Capacity(); ++i) {
+        if (used(i)) {
+          index[i] = std::lower_bound(sorted.begin(), sorted.end(), ids[i]) -
+                     sorted.begin();
+          old_neighbors[index[i]] = std::move(neighbors[i]);
+        }
+      }
+      ids.Clear();
+      for (int id : sorted) {
+        ids.Insert(id);
+      }
+      neighbors = std::move(old_neighbors);
+      return index;
+    };
+    std::vector<int> character_index =
+        renumber(workspace.character_ids, character_tasks_);
+    std::vector<int> task_index =
+        renumber(workspace.task_ids, task_characters_);
+    for (auto &tasks : character_tasks_) {
+      for (int &t : tasks) {
+        t = task_index[t];
+      }
+    }
+    for (auto &characters : task_characters_) {
+      for (int &c : characters) {
+        c = character_index[c];
+      }
+    }
+    std::unordered_map<uint64_t, Cost> costs;
+    costs.reserve(costs_.size());
+    for (auto &[key, cost] : costs_) {
+      costs.emplace(Key(character_index[key >> 32],
+                        task_index[(uint32_t)key]),
+                    cost);
+    }
+    costs_ = std::move(costs);
+  }
+
+  // Fills the cost matrix from scratch. It gets some spare rows & columns so
+  // that new ids usually fit in without another rebuild.
+  void Rebuild(int num_characters, int num_tasks) {
+    BasicWorkspace<Cost> &ws = workspace;
+    int old_NX = ws.NX, old_NY = ws.NY;
+    bool compatible = ws.compact;
+    bool transpose = !(num_tasks > num_characters);
+    compatible &= transpose == ws.transpose;
+    int X = transpose ? num_tasks : num_characters;
+    int Y = transpose ? num_characters : num_tasks;
+    int NX = X + X / 4 + 8;
+    int NY = std::max(Y + Y / 4 + 8, NX);
+    ws.transpose = transpose;
+    ws.compact = true;
+    ws.max_cost = MaxCost();
+    std::swap(ws.value, ws.prev_value);
+    ws.value.assign((size_t)NX * NY, -ws.max_cost);
+    for (auto &[key, cost] : costs_) {
+      int c = key >> 32, t = (uint32_t)key;
+      int x = transpose ? t : c, y = transpose ? c : t;
+      ws.value[(size_t)x * NY + y] = -cost;
+    }
+    internal::ResolveDense(ws, NX, NY, old_NX, old_NY, compatible);
+  }
+
+  Cost unassigned_cost_;
+  std::unordered_map<uint64_t, Cost> costs_; // potential assignments
+  std::map<Cost, int> histogram_;            // number of pairs with each cost
+  std::vector<std::vector<int>> character_tasks_; // tasks of each character
+  std::vector<std::vector<int>> task_characters_; // characters of each task
+  std::vector<std::pair<int, int>> dirty_; // pairs changed since `Solve`
+  std::vector<BasicAssignment<Cost>> result_;
+};
+
+typedef BasicScheduler<double> Scheduler;
+
 } // namespace colony
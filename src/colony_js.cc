@@ -17,6 +17,82 @@
 using namespace emscripten;
 using namespace colony;
 
+#ifdef __EMSCRIPTEN_PTHREADS__
+// Pthreads build (see `colony_pthreads.js` in the Makefile). Solvers split
+// their work across this pool. Threads block while waiting for jobs so this
+// build should run inside a worker (see `Module.create_worker`).
+ThreadPool &Pool() {
+    static ThreadPool pool;
+    return pool;
+}
+#endif
+
+// Workspace of `C_OptimizeBatch`.
+BatchWorkspace &Batch() {
+    static BatchWorkspace workspace;
+    return workspace;
+}
+
+// Results of `OptimizeColumns` & `LimitColumns` before they're copied out.
+template <typename Cost> BasicAssignmentBuffer<Cost> &Columns() {
+    static BasicAssignmentBuffer<Cost> assignments;
+    return assignments;
+}
+
+// View of `n` assignments stored as columns in the WASM heap. Pointers come
+// from JavaScript typed arrays.
+template <typename Cost>
+BasicAssignmentColumns<Cost> View(uintptr_t characters, uintptr_t tasks,
+                                  uintptr_t costs, int n) {
+    return {{reinterpret_cast<const uint32_t *>(characters), (size_t)n},
+            {reinterpret_cast<const uint32_t *>(tasks), (size_t)n},
+            {reinterpret_cast<const Cost *>(costs), (size_t)n}};
+}
+
+// Copies the results to the output columns (which may be the same as the
+// input ones). Returns their number.
+template <typename Cost>
+int CopyOut(const BasicAssignmentBuffer<Cost> &results,
+            uintptr_t out_characters, uintptr_t out_tasks,
+            uintptr_t out_costs) {
+    int size = results.size();
+    std::copy_n(results.characters.data(), size,
+                reinterpret_cast<uint32_t *>(out_characters));
+    std::copy_n(results.tasks.data(), size,
+                reinterpret_cast<uint32_t *>(out_tasks));
+    std::copy_n(results.costs.data(), size,
+                reinterpret_cast<Cost *>(out_costs));
+    return size;
+}
+
+// Optimizes `n` assignments stored as columns in the WASM heap. The solver
+// reads the columns in place. Optimal assignments are written to the output
+// columns. Returns their number.
+template <typename Cost>
+int OptimizeColumns(uintptr_t characters, uintptr_t tasks, uintptr_t costs,
+                    int n, uintptr_t out_characters, uintptr_t out_tasks,
+                    uintptr_t out_costs) {
+#ifdef __EMSCRIPTEN_PTHREADS__
+    // Default workspaces are per thread - set on every call.
+    DefaultWorkspace<Cost>().executor = Pool().AsExecutor();
+#endif
+    BasicAssignmentBuffer<Cost> &results = Columns<Cost>();
+    Optimize(View<Cost>(characters, tasks, costs, n), results);
+    return CopyOut(results, out_characters, out_tasks, out_costs);
+}
+
+// Same as above but for `LimitAssignments`.
+template <typename Cost>
+int LimitColumns(uintptr_t characters, uintptr_t tasks, uintptr_t costs, int n,
+                 int limit_per_character, int limit_per_task,
+                 uintptr_t out_characters, uintptr_t out_tasks,
+                 uintptr_t out_costs) {
+    BasicAssignmentBuffer<Cost> &results = Columns<Cost>();
+    LimitAssignments(View<Cost>(characters, tasks, costs, n),
+                     limit_per_character, limit_per_task, results);
+    return CopyOut(results, out_characters, out_tasks, out_costs);
+}
+
 EMSCRIPTEN_BINDINGS(my_module) {
     value_object<Assignment>("Assignment")
         .field("character", &Assignment::character)
@@ -24,8 +100,42 @@ EMSCRIPTEN_BINDINGS(my_module) {
         .field("cost", &Assignment::cost);
 
     register_vector<Assignment>("C_vector<Assignment>");
+    register_vector<int>("C_vector<int>");
 
     function("C_ComputeCost", &ComputeCost);
-    function("C_LimitAssignments", &LimitAssignments);
-    function("C_Optimize", &Optimize);
+    function("C_LimitAssignments",
+             select_overload<void(std::vector<Assignment> &, int, int)>(
+                 &LimitAssignments));
+    function("C_Optimize",
+             select_overload<void(std::vector<Assignment> &)>(&Optimize));
+    function("C_Reoptimize",
+             select_overload<void(std::vector<Assignment> &)>(&Reoptimize));
+    function("C_OptimizeSparse",
+             select_overload<void(std::vector<Assignment> &)>(&OptimizeSparse));
+    function("C_OptimizeColumns", &OptimizeColumns<double>);
+    function("C_OptimizeColumnsFloat", &OptimizeColumns<float>);
+    function("C_LimitColumns", &LimitColumns<double>);
+    function("C_LimitColumnsFloat", &LimitColumns<float>);
+    function("C_OptimizeBatch", +[](std::vector<Assignment> &assignments,
+                                    std::vector<int> &offsets) {
+        BatchWorkspace &workspace = Batch();
+#ifdef __EMSCRIPTEN_PTHREADS__
+        workspace.executor = Pool().AsExecutor();
+#endif
+        OptimizeBatch(assignments, offsets, workspace);
+    });
+    function("C_MemoryUsage", +[]() -> double {
+        return MemoryUsage(DefaultWorkspace<double>()) +
+               MemoryUsage(DefaultWorkspace<float>()) +
+               MemoryUsage(Batch()) +
+               Columns<double>().costs.capacity() * (8 + sizeof(double)) +
+               Columns<float>().costs.capacity() * (8 + sizeof(float));
+    });
+    function("C_ReleaseMemory", +[]() {
+        ReleaseMemory(DefaultWorkspace<double>());
+        ReleaseMemory(DefaultWorkspace<float>());
+        ReleaseMemory(Batch());
+        Columns<double>() = {};
+        Columns<float>() = {};
+    });
 }
@@ -19,11 +19,113 @@ Module['compute_cost'] = function (obj) {
   return Module.C_ComputeCost(obj.travel_time || 0, obj.work_time || 0, obj.retry_risk || 0, obj.priority || 1);
 };
 
+// Columns of assignments allocated in the WASM heap.
+//
+// Row i is the assignment of `characters[i]` to `tasks[i]` with cost `costs[i]`.
+// Characters and tasks are unsigned 32-bit integers. Costs are stored in a
+// `Float64Array` unless `CostArray` is `Float32Array`. The columns can be passed
+// to `optimize_columns` & `limit_columns` without copying. Call `free()` when they're no longer
+// needed.
+//
+// Usage:
+//
+//   let columns = Module.alloc_columns(1000);
+//   columns.characters[0] = 5; columns.tasks[0] = 7; columns.costs[0] = 10;
+//   let n = Module.optimize_columns(columns, 1);
+Module['alloc_columns'] = function (capacity, CostArray = Float64Array) {
+  let characters_ptr = Module._malloc(capacity * 4);
+  let tasks_ptr = Module._malloc(capacity * 4);
+  let costs_ptr = Module._malloc(capacity * CostArray.BYTES_PER_ELEMENT);
+  let views = null;
+  // Views get detached when the WASM memory grows so they're recreated lazily.
+  let view = function (name) {
+    if (views === null || views.characters.buffer !== HEAP8.buffer) {
+      views = { characters: new Uint32Array(HEAP8.buffer, characters_ptr, capacity),
+                tasks: new Uint32Array(HEAP8.buffer, tasks_ptr, capacity),
+                costs: new CostArray(HEAP8.buffer, costs_ptr, capacity) };
+    }
+    return views[name];
+  };
+  return {
+    capacity: capacity,
+    get characters() { return view('characters'); },
+    get tasks() { return view('tasks'); },
+    get costs() { return view('costs'); },
+    free: function () {
+      Module._free(characters_ptr);
+      Module._free(tasks_ptr);
+      Module._free(costs_ptr);
+      characters_ptr = tasks_ptr = costs_ptr = 0;
+    }
+  };
+};
+
+// Low-level version of `optimize` that doesn't allocate any JS objects.
+//
+// Takes the first `count` rows of `input` (columns from `alloc_columns`, or any
+// object with `characters`, `tasks` & `costs` typed arrays placed in the WASM
+// heap) and writes the optimal assignments to the first rows of `output`.
+// By default `output` is the same as `input`. Returns the number of optimal
+// assignments.
+//
+// Usage:
+//
+//   let n = Module.optimize_columns(columns, count);
+//   for (let i = 0; i < n; i++) {
+//     console.log(columns.characters[i], columns.tasks[i], columns.costs[i]);
+//   }
+Module['optimize_columns'] = function (input, count, output = input) {
+  check_columns('optimize_columns', input, count, output);
+  let costs = input.costs;
+  let optimize = costs instanceof Float32Array ? Module.C_OptimizeColumnsFloat : Module.C_OptimizeColumns;
+  return optimize(input.characters.byteOffset, input.tasks.byteOffset, costs.byteOffset, count,
+                  output.characters.byteOffset, output.tasks.byteOffset, output.costs.byteOffset);
+};
+
+// Reduces the number of potential assignments for each character & task (see
+// `LimitAssignments` in colony.h).
+//
+// Takes the first `count` rows of `input` (see `optimize_columns`), keeps the
+// `limit_per_character` cheapest rows of each character & then, out of those,
+// the `limit_per_task` cheapest rows of each task. Writes them to the first rows
+// of `output` & returns their number. The result can be passed straight to
+// `optimize_columns`.
+Module['limit_columns'] = function (input, count, limit_per_character, limit_per_task, output = input) {
+  check_columns('limit_columns', input, count, output);
+  let costs = input.costs;
+  let limit = costs instanceof Float32Array ? Module.C_LimitColumnsFloat : Module.C_LimitColumns;
+  return limit(input.characters.byteOffset, input.tasks.byteOffset, costs.byteOffset, count,
+               limit_per_character, limit_per_task,
+               output.characters.byteOffset, output.tasks.byteOffset, output.costs.byteOffset);
+};
+
+// Throws unless `input` & `output` are columns in the WASM heap with at least
+// `count` rows & costs of the same type.
+function check_columns(name, input, count, output) {
+  for (let columns of [input, output]) {
+    for (let array of [columns.characters, columns.tasks, columns.costs]) {
+      if (array.buffer !== HEAP8.buffer) {
+        throw new Error(name + ' expects typed arrays placed in the WASM heap (see alloc_columns)');
+      }
+      if (array.length < count) {
+        throw new Error(name + ' got columns shorter than ' + count);
+      }
+    }
+  }
+  if ((input.costs instanceof Float32Array) !== (output.costs instanceof Float32Array)) {
+    throw new Error(name + ' expects costs of the same type in input & output');
+  }
+}
+
+// Columns reused by `optimize` across calls. They only grow.
+let optimize_columns = null;
+
 // Main function for optimizing task assignments.
 //
 // The function takes a list of assignments (objects with `character`, `task` and `cost` fields)
 // and returns optimized list of assignments - with at most one task per character.
-// The `character` and `task` fields should be strings (or string-convertible).
+// The `character` and `task` fields should be strings (or string-convertible). They're compared
+// & returned as strings - so `1` and `"1"` are the same character.
 // The `cost` field should be a number >= 0.
 //
 // Usage:
@@ -36,28 +138,307 @@ Module['compute_cost'] = function (obj) {
 //   console.log(optimized); // [{ character: "John", task: "mop up blood at 10,10", cost: 10 },
 //                           //  { character: "Fred", task: "construct wall at 15,15", cost: 10 }]
 Module['optimize'] = function (assignments) {
-  let assignments_c = new Module['C_vector$Assignment$']();
+  if (optimize_columns === null || optimize_columns.capacity < assignments.length) {
+    if (optimize_columns !== null) {
+      optimize_columns.free();
+    }
+    optimize_columns = Module.alloc_columns(Math.max(assignments.length, 1024));
+  }
+  let columns = optimize_columns;
   // C++ code expects characters and tasks to be small integers.
-  // We map strings to integers and back.
-  let character_to_x = {};
-  let task_to_y = {};
+  // We map them to integers and back.
+  let character_to_x = new Map();
+  let task_to_y = new Map();
+  let x_to_character = [];
+  let y_to_task = [];
+  let characters = columns.characters, tasks = columns.tasks, costs = columns.costs;
   for (let i = 0; i < assignments.length; i++) {
     let a = assignments[i];
-    let x = a.character in character_to_x ? character_to_x[a.character] : character_to_x[a.character] = Object.keys(character_to_x).length;
-    let y = a.task in task_to_y ? task_to_y[a.task] : task_to_y[a.task] = Object.keys(task_to_y).length;
-    assignments_c.push_back({ character: x, task: y, cost: a.cost});
+    let character = String(a.character), task = String(a.task);
+    let x = character_to_x.get(character);
+    if (x === undefined) {
+      x = x_to_character.length;
+      character_to_x.set(character, x);
+      x_to_character.push(character);
+    }
+    let y = task_to_y.get(task);
+    if (y === undefined) {
+      y = y_to_task.length;
+      task_to_y.set(task, y);
+      y_to_task.push(task);
+    }
+    characters[i] = x;
+    tasks[i] = y;
+    costs[i] = a.cost;
   }
-  let x_to_character = Object.keys(character_to_x).reduce((acc, x) => { acc[character_to_x[x]] = x; return acc; }, Array());
-  let y_to_task = Object.keys(task_to_y).reduce((acc, y) => { acc[task_to_y[y]] = y; return acc; }, Array());
-  Module.C_Optimize(assignments_c);
+  let size = Module.optimize_columns(columns, assignments.length);
+  characters = columns.characters, tasks = columns.tasks, costs = columns.costs;
   let optimized = [];
-  let size = assignments_c.size();
   for (let i = 0; i < size; i++) {
-    let result = assignments_c.get(i);
-    optimized.push({ character: x_to_character[result.character],
-                     task: y_to_task[result.task],
-                     cost: result.cost });
+    optimized.push({ character: x_to_character[characters[i]],
+                     task: y_to_task[tasks[i]],
+                     cost: costs[i] });
+  }
+  return optimized;
+};
+
+// Returns the number of bytes held by the solver (its workspaces & buffers).
+// They only grow so this is the high-water mark of the problems solved so far.
+// Each problem with C characters and T tasks needs at most C * T * 8 bytes for
+// the cost matrix (C * T * 4 when the costs are a `Float32Array`) plus less
+// than 64 bytes per character, task & assignment - the bound from the "Memory"
+// section of colony.h with `sizeof(Cost)` of the costs used by the binding.
+// The columns of `optimize` add 16 bytes per assignment.
+Module['memory_usage'] = function () {
+  let bytes = Module.C_MemoryUsage();
+  if (optimize_columns !== null) {
+    bytes += optimize_columns.capacity * 16;
+  }
+  return bytes;
+};
+
+// Frees the memory held by the solver - for example after a rare, huge
+// problem. The freed memory is reused by later allocations but the WASM memory
+// itself never shrinks.
+Module['release_memory'] = function () {
+  Module.C_ReleaseMemory();
+  if (optimize_columns !== null) {
+    optimize_columns.free();
+    optimize_columns = null;
+  }
+};
+
+// Optimizes many independent lists of assignments (for example of separate
+// colonies) in a single call.
+//
+// Takes an array of lists of assignments (same as the ones accepted by
+// `optimize`) and returns an array of optimized lists.
+//
+// Usage:
+//
+//   let [first, second] = Module.optimize_batch([first_colony, second_colony]);
+Module['optimize_batch'] = function (problems) {
+  let assignments_c = new Module['C_vector$Assignment$']();
+  let offsets_c = new Module['C_vector$int$']();
+  let x_to_character = [];
+  let y_to_task = [];
+  for (let p = 0; p < problems.length; p++) {
+    offsets_c.push_back(assignments_c.size());
+    // Each problem has its own mapping of strings to small integers.
+    let character_to_x = new Map();
+    let task_to_y = new Map();
+    let characters = [];
+    let tasks = [];
+    for (let a of problems[p]) {
+      let character = String(a.character), task = String(a.task);
+      let x = character_to_x.get(character);
+      if (x === undefined) {
+        x = characters.length;
+        character_to_x.set(character, x);
+        characters.push(character);
+      }
+      let y = task_to_y.get(task);
+      if (y === undefined) {
+        y = tasks.length;
+        task_to_y.set(task, y);
+        tasks.push(task);
+      }
+      assignments_c.push_back({ character: x, task: y, cost: a.cost });
+    }
+    x_to_character.push(characters);
+    y_to_task.push(tasks);
+  }
+  offsets_c.push_back(assignments_c.size());
+  Module.C_OptimizeBatch(assignments_c, offsets_c);
+  let optimized = [];
+  for (let p = 0; p < problems.length; p++) {
+    let list = [];
+    for (let i = offsets_c.get(p); i < offsets_c.get(p + 1); i++) {
+      let result = assignments_c.get(i);
+      list.push({ character: x_to_character[p][result.character],
+                  task: y_to_task[p][result.task],
+                  cost: result.cost });
+    }
+    optimized.push(list);
   }
   assignments_c.delete();
+  offsets_c.delete();
   return optimized;
 }
+
+// URL of this script. Workers started by `create_worker` load it again.
+let colony_script = typeof document !== 'undefined' && document.currentScript ? document.currentScript.src : undefined;
+
+// Columns of assignments in ordinary (transferable) array buffers.
+function worker_columns(capacity, CostArray) {
+  return { characters: new Uint32Array(capacity),
+           tasks: new Uint32Array(capacity),
+           costs: new CostArray(capacity) };
+}
+
+function worker_buffers(columns) {
+  return [columns.characters.buffer, columns.tasks.buffer, columns.costs.buffer];
+}
+
+// Solver running in a Web Worker. See `create_worker`.
+class ColonyWorker {
+  constructor(options) {
+    this.CostArray = options.cost_array || Float64Array;
+    this.worker = new Worker(options.script || colony_script, { name: 'colony_worker' });
+    this.worker.onmessage = (e) => this._receive(e.data);
+    this.onresult = null;  // called with each new result
+    this.frame = 0;        // number of submitted frames
+    this.result = { frame: 0, count: 0, ...worker_columns(0, this.CostArray) };
+    this.columns = null;   // columns returned by `begin`
+    this.pending = null;   // submitted frame that the worker didn't take yet
+    this.busy = false;     // whether the worker is solving some frame
+    this.inputs = [];      // spare input columns
+    this.outputs = [];     // spare result columns
+  }
+
+  // Number of frames submitted after the one that produced `result`.
+  get frames_behind() {
+    return this.frame - this.result.frame;
+  }
+
+  // Returns columns with room for `count` potential assignments. Fill the first
+  // `count` rows & pass them to `submit`.
+  begin(count) {
+    if (this.columns === null) {
+      if (this.pending !== null) {
+        // The worker didn't take the last frame yet. It's replaced by this one.
+        this.columns = this.pending.columns;
+        this.pending = null;
+      } else if (this.inputs.length) {
+        this.columns = this.inputs.pop();
+      }
+    }
+    if (this.columns === null || this.columns.characters.length < count) {
+      this.columns = worker_columns(Math.max(count, 1024), this.CostArray);
+    }
+    return this.columns;
+  }
+
+  // Sends the first `count` rows of the columns from `begin` to the worker.
+  // Returns the number of the submitted frame.
+  submit(count) {
+    this.pending = { frame: ++this.frame, count: count, columns: this.columns };
+    this.columns = null;
+    this._send();
+    return this.frame;
+  }
+
+  terminate() {
+    this.worker.terminate();
+  }
+
+  _send() {
+    if (this.busy || this.pending === null) {
+      return;
+    }
+    let pending = this.pending;
+    this.pending = null;
+    this.busy = true;
+    let result = this.outputs.pop() || null;
+    let transfer = worker_buffers(pending.columns);
+    if (result !== null) {
+      transfer.push(...worker_buffers(result));
+    }
+    this.worker.postMessage({ frame: pending.frame, count: pending.count,
+                              input: pending.columns, result: result }, transfer);
+  }
+
+  _receive(message) {
+    this.busy = false;
+    this.inputs.push(message.input);
+    // Double buffering - the previous front buffer becomes the next back buffer.
+    if (this.result.characters.length) {
+      this.outputs.push(this.result);
+    }
+    this.result = { frame: message.frame, count: message.count, ...message.result };
+    this._send();
+    if (this.onresult) {
+      this.onresult(this.result);
+    }
+  }
+}
+
+// Starts a solver in a Web Worker so that the render loop never waits for it.
+//
+// The game fills the columns returned by `begin(count)` (same layout as in
+// `alloc_columns`) and calls `submit(count)`. Buffers are transferred to the
+// worker, not copied. The worker always solves the newest submitted frame -
+// frames that were replaced before the worker got to them are dropped.
+//
+// The latest optimal assignments are kept in `result` (`frame`, `count` and
+// the `characters`, `tasks` & `costs` columns). They're double-buffered so
+// reading them never blocks. `frames_behind` tells how many frames were
+// submitted after the one that produced `result` - the game can decide whether
+// such stale assignments are still acceptable.
+//
+// Options:
+//   script - URL of colony.js (or colony_pthreads.js) to run in the worker.
+//            Defaults to the script that defined this function.
+//   cost_array - `Float64Array` (default) or `Float32Array`.
+//
+// Usage:
+//
+//   let solver = Module.create_worker();
+//   function tick() {
+//     let columns = solver.begin(count);
+//     ... fill columns.characters, columns.tasks & columns.costs ...
+//     solver.submit(count);
+//     let result = solver.result;
+//     for (let i = 0; i < result.count; i++) { ... }
+//   }
+Module['create_worker'] = function (options = {}) {
+  return new ColonyWorker(options);
+};
+
+// Worker side of `create_worker`.
+if (typeof WorkerGlobalScope !== 'undefined' && self instanceof WorkerGlobalScope && self.name === 'colony_worker') {
+  let columns = null;  // columns in the WASM heap
+  let queue = [];      // messages received before the runtime was ready
+  let solve = function (message) {
+    let input = message.input;
+    let count = message.count;
+    let CostArray = input.costs.constructor;
+    if (columns === null || columns.capacity < input.characters.length ||
+        !(columns.costs instanceof CostArray)) {
+      if (columns !== null) {
+        columns.free();
+      }
+      columns = Module.alloc_columns(input.characters.length, CostArray);
+    }
+    columns.characters.set(input.characters.subarray(0, count));
+    columns.tasks.set(input.tasks.subarray(0, count));
+    columns.costs.set(input.costs.subarray(0, count));
+    let n = Module.optimize_columns(columns, count);
+    let result = message.result;
+    if (result === null || result.characters.length < n ||
+        !(result.costs instanceof CostArray)) {
+      result = worker_columns(input.characters.length, CostArray);
+    }
+    result.characters.set(columns.characters.subarray(0, n));
+    result.tasks.set(columns.tasks.subarray(0, n));
+    result.costs.set(columns.costs.subarray(0, n));
+    self.postMessage({ frame: message.frame, count: n, input: input, result: result },
+                     [...worker_buffers(input), ...worker_buffers(result)]);
+  };
+  let on_runtime_initialized = Module['onRuntimeInitialized'];
+  Module['onRuntimeInitialized'] = function () {
+    if (on_runtime_initialized) {
+      on_runtime_initialized();
+    }
+    let messages = queue;
+    queue = null;
+    messages.forEach(solve);
+  };
+  self.onmessage = function (e) {
+    if (queue !== null) {
+      queue.push(e.data);
+    } else {
+      solve(e.data);
+    }
+  };
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2023 Marek Rogalski
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the standard MIT license. See LICENSE for more details.
+ */
+
+/////////////////////////////////////////////////////////////
+// Scenarios shared by the SDL demo & the benchmark suite. //
+/////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "colony.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+const int SIZE = 256; // width & height of the map
+
+struct Character {
+  int x;
+  int y;
+};
+
+struct Work {
+  int x;
+  int y;
+  int t;
+};
+
+struct Scene {
+  std::vector<Character> characters;
+  std::vector<Work> work;
+  uint32_t seed = 1;
+
+  // Deterministic random numbers in [0, 32768). Unlike `rand` they're the same
+  // on every platform so native & WASM builds get the same scenes.
+  int Random() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+  }
+
+  void Clear() {
+    characters.clear();
+    work.clear();
+  }
+
+  // Cost of `work[task]` for `characters[character]`.
+  double Cost(int character, int task) const {
+    const Character &c = characters[character];
+    const Work &w = work[task];
+    return (double)std::max(std::abs(c.x - w.x), std::abs(c.y - w.y)) + w.t;
+  }
+
+  // Moves the characters one step towards their tasks. Characters that reached
+  // their tasks work on them instead. Finished tasks are removed.
+  void Step(const std::vector<colony::Assignment> &assignments) {
+    for (auto &a : assignments) {
+      Character &c = characters[a.character];
+      Work &w = work[a.task];
+      int dx = w.x - c.x;
+      int dy = w.y - c.y;
+      c.x += (dx > 0) - (dx < 0);
+      c.y += (dy > 0) - (dy < 0);
+      if (dx == 0 && dy == 0) {
+        --w.t;
+      }
+    }
+    for (auto &c : characters) {
+      c.x %= SIZE;
+      c.y %= SIZE;
+    }
+    for (int i = 0; i < (int)work.size(); ++i) {
+      if (work[i].t == 0) {
+        std::swap(work[i], work.back());
+        work.pop_back();
+        --i;
+      }
+    }
+  }
+};
+
+// Scenario that fills a scene. `size` is the number of characters or tasks -
+// whichever is bigger.
+struct Stage {
+  const char *name;
+  int size;  // size used by the demo
+  int limit; // number of steps in which the demo should complete the stage
+  void (*fill)(Scene &scene, int size);
+};
+
+inline void StageRandom(Scene &scene, int size) {
+  for (int i = 0; i < std::max(size / 10, 1); ++i) {
+    scene.characters.push_back(
+        Character{scene.Random() % SIZE, scene.Random() % SIZE});
+  }
+  for (int i = 0; i < size; ++i) {
+    scene.work.push_back(
+        Work{scene.Random() % SIZE, scene.Random() % SIZE, 10});
+  }
+}
+
+inline void StageRow(Scene &scene, int size) {
+  for (int i = 0; i < size; ++i) {
+    scene.characters.push_back(Character{25, 25 + i * 200 / size});
+  }
+  for (int i = 0; i < size; ++i) {
+    scene.work.push_back(Work{225, 25 + i * 200 / size, 10});
+  }
+}
+
+inline void StageSkew(Scene &scene, int size) {
+  for (int i = 0; i < size; ++i) {
+    scene.characters.push_back(Character{25, 5 + i * 200 / size});
+  }
+  for (int i = 0; i < size; ++i) {
+    scene.work.push_back(Work{225, 50 + i * 200 / size, 10});
+  }
+}
+
+inline void StageThatGuy(Scene &scene, int size) {
+  for (int i = 0; i < size; ++i) {
+    scene.characters.push_back(
+        Character{25, 128 + (i - size / 2) * 40 / size});
+  }
+  scene.characters.push_back(Character{200, 128});
+  for (int i = 0; i < size; ++i) {
+    scene.work.push_back(Work{225, 128 + (i - size / 2) * 40 / size, 10});
+  }
+}
+
+inline void StageCircle(Scene &scene, int size) {
+  for (int i = 0; i < size; ++i) {
+    int x = (int)(128 + 120 * cos(i / (double)size * M_PI * 2));
+    int y = (int)(128 + 120 * sin(i / (double)size * M_PI * 2));
+    scene.characters.push_back(Character{x, y});
+  }
+  scene.work.push_back(Work{128, 128, 10});
+}
+
+inline void StageSquare(Scene &scene, int size) {
+  int side = std::max(size / 4, 1);
+  for (int i = 0; i < side; ++i) {
+    int offset = (i - side / 2) * 200 / side;
+    scene.characters.push_back(Character{128 + offset, 128 + 100});
+    scene.characters.push_back(Character{128 + offset, 128 - 100});
+    scene.characters.push_back(Character{128 + 100, 128 + offset});
+    scene.characters.push_back(Character{128 - 100, 128 + offset});
+  }
+  scene.work.push_back(Work{128, 128, 10});
+}
+
+inline void StageSquare2(Scene &scene, int size) {
+  int side = std::max(size / 4, 1);
+  for (int i = 0; i < side; ++i) {
+    int offset = (i - side / 2) * 200 / side;
+    scene.work.push_back(Work{128 + offset, 128 + 100, 10});
+    scene.work.push_back(Work{128 + offset, 128 - 100, 10});
+    scene.work.push_back(Work{128 + 100, 128 + offset, 10});
+    scene.work.push_back(Work{128 - 100, 128 + offset, 10});
+  }
+  for (int i = 0; i < side * 4; ++i) {
+    scene.characters.push_back(Character{128, 128});
+  }
+}
+
+inline void StageInsane(Scene &scene, int size) {
+  for (int i = 0; i < std::max(size / 4, 1); ++i) {
+    scene.characters.push_back(
+        Character{scene.Random() % SIZE, scene.Random() % SIZE});
+  }
+  for (int i = 0; i < size; ++i) {
+    scene.work.push_back(
+        Work{scene.Random() % SIZE, scene.Random() % SIZE, 10});
+  }
+}
+
+// Stages in the order of the demo.
+inline const std::vector<Stage> &Stages() {
+  static const std::vector<Stage> stages = {
+      {"Random", 500, 280, StageRandom},
+      {"Square", 40, 110, StageSquare},
+      {"Inversed square", 40, 110, StageSquare2},
+      {"Circle", 50, 97, StageCircle},
+      {"That guy", 10, 161, StageThatGuy},
+      {"Row", 50, 210, StageRow},
+      {"Skewed row", 50, 210, StageSkew},
+      {"Insane", 2000, 101, StageInsane}, // Usually will be ~70
+  };
+  return stages;
+}
@@ -0,0 +1,1404 @@
+/*
+ * Copyright 2023 Marek Rogalski
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the standard MIT license. See LICENSE for more details.
+ */
+
+////////////////////////////////////////////////////////////////////
+// Property test that compares every solver with a reference one. //
+////////////////////////////////////////////////////////////////////
+
+// Random & adversarial problems (ties, rectangular shapes, sparse ids,
+// duplicate pairs, negative costs, impossible pairs from `ComputeCost`, ...)
+// are solved by every engine & entry point of the library. Each result must
+// be a valid assignment (at most one task per character & one character per
+// task, only given & possible pairs) whose total matches a simple O(n^3)
+// Hungarian algorithm. The reference itself is checked against brute force on
+// the small problems. Every cost type is tested. The solvers that aren't
+// optimal (zones, tight limits, long-term plans) are checked for validity.
+//
+// The objective is the one of `Optimize`: leaving a character unassigned
+// costs as much as the most expensive potential assignment (or 0, whichever
+// is bigger). So the solvers maximize the total of `max_cost - cost` over the
+// assigned pairs.
+//
+// Usage: colony_test [--seed N] [--cases N] [--verbose]
+//
+// Built with `make test` (which also runs it) - once with the SIMD kernels &
+// once with the scalar ones (COLONY_NO_SIMD). Failures print the seed & case
+// so that they can be reproduced with `--seed N --cases 1`.
+
+#include "colony.h"
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using colony::BasicAssignment;
+
+struct Options {
+  uint64_t seed = 1;
+  int cases = 300;      // problems generated for each cost type
+  bool verbose = false; // print every case
+};
+
+// Randomly generated problem. Costs are doubles - they're converted to each
+// cost type before solving.
+struct Case {
+  const char *generator;
+  uint64_t seed;
+  vector<colony::Assignment> assignments; // may list impossible pairs
+  // Full cost matrix (infinity for the impossible pairs) when the ids are
+  // dense & there are no duplicate pairs. Used by the `cost(c, t)` variants.
+  int num_characters = 0, num_tasks = 0;
+  vector<double> matrix;
+};
+
+typedef mt19937_64 Rng;
+
+int Uniform(Rng &rng, int lo, int hi) { // [lo, hi]
+  return uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+bool Chance(Rng &rng, double p) { return bernoulli_distribution(p)(rng); }
+
+// Most problems are tiny so that brute force can check the reference. Some
+// are big enough to span many SIMD vectors & parallel jobs.
+int Size(Rng &rng) {
+  int r = Uniform(rng, 0, 9);
+  return r < 6 ? Uniform(rng, 0, 7) : r < 9 ? Uniform(rng, 1, 40)
+                                             : Uniform(rng, 50, 150);
+}
+
+// Generates the pairs from a full matrix. Pairs are listed in a random order.
+// Impossible pairs are listed (with infinite costs) with the probability
+// `impossible` - the solvers must skip them.
+void FromMatrix(Case &c, Rng &rng, double impossible) {
+  for (int i = 0; i < c.num_characters; ++i) {
+    for (int j = 0; j < c.num_tasks; ++j) {
+      double cost = c.matrix[i * c.num_tasks + j];
+      if (cost < numeric_limits<double>::infinity() ||
+          Chance(rng, impossible)) {
+        c.assignments.push_back({i, j, cost});
+      }
+    }
+  }
+  shuffle(c.assignments.begin(), c.assignments.end(), rng);
+}
+
+// Matrix with `density` of the pairs possible & costs from `cost()`.
+template <typename CostFn>
+void Dense(Case &c, Rng &rng, int C, int T, double density, CostFn cost,
+           double impossible = 0) {
+  c.num_characters = C;
+  c.num_tasks = T;
+  c.matrix.assign(C * T, numeric_limits<double>::infinity());
+  for (int i = 0; i < C; ++i) {
+    for (int j = 0; j < T; ++j) {
+      if (Chance(rng, density)) {
+        c.matrix[i * T + j] = cost(i, j);
+      }
+    }
+  }
+  FromMatrix(c, rng, impossible);
+}
+
+double Density(Rng &rng) {
+  const double densities[] = {0.1, 0.3, 0.6, 1, 1};
+  return densities[Uniform(rng, 0, 4)];
+}
+
+struct Generator {
+  const char *name;
+  void (*fill)(Case &c, Rng &rng);
+};
+
+const Generator kGenerators[] = {
+    {"uniform",
+     [](Case &c, Rng &rng) {
+       Dense(c, rng, Size(rng), Size(rng), Density(rng),
+             [&](int, int) { return Uniform(rng, 0, 1000); });
+     }},
+    // Few distinct costs - many optimal assignments & tight edges.
+    {"ties",
+     [](Case &c, Rng &rng) {
+       int values = Uniform(rng, 1, 3);
+       Dense(c, rng, Size(rng), Size(rng), Density(rng),
+             [&](int, int) { return Uniform(rng, 1, values); });
+     }},
+    // Few characters & many tasks or the other way around.
+    {"rectangular",
+     [](Case &c, Rng &rng) {
+       int a = Uniform(rng, 1, 3), b = Uniform(rng, 5, 60);
+       if (Chance(rng, 0.5)) {
+         swap(a, b);
+       }
+       Dense(c, rng, a, b, Density(rng),
+             [&](int, int) { return Uniform(rng, 0, 100); });
+     }},
+    // Negative costs leave the maximum cost (& the cost of leaving characters
+    // unassigned) at 0.
+    {"negative",
+     [](Case &c, Rng &rng) {
+       int offset = Uniform(rng, 0, 1) ? 100 : 1000;
+       Dense(c, rng, Size(rng), Size(rng), Density(rng),
+             [&](int, int) { return Uniform(rng, -offset, 100); });
+     }},
+    // Worst case of the Hungarian algorithm: every augmentation relabels.
+    {"product",
+     [](Case &c, Rng &rng) {
+       Dense(c, rng, Size(rng), Size(rng), 1,
+             [&](int i, int j) { return (i + 1) * (j + 1); });
+     }},
+    // Many pairs cost exactly as much as leaving the character unassigned.
+    {"max_cost",
+     [](Case &c, Rng &rng) {
+       Dense(c, rng, Size(rng), Size(rng), Density(rng), [&](int, int) {
+         return Chance(rng, 0.5) ? 50 : Uniform(rng, 0, 50);
+       });
+     }},
+    // Costs from `ComputeCost` - some of the tasks are impossible.
+    {"compute_cost",
+     [](Case &c, Rng &rng) {
+       Dense(
+           c, rng, Size(rng), Size(rng), 1,
+           [&](int, int) {
+             const double risks[] = {0, 0, 0.5, 0.75, 1};
+             const double priorities[] = {1, 1, 2, 4, 0};
+             return colony::ComputeCost(
+                 Uniform(rng, 0, 200), Uniform(rng, 0, 50),
+                 risks[Uniform(rng, 0, 4)], priorities[Uniform(rng, 0, 4)]);
+           },
+           0.5);
+     }},
+    // Independent groups of characters & tasks (the components of `Optimize`).
+    {"components",
+     [](Case &c, Rng &rng) {
+       int groups = Uniform(rng, 2, 6);
+       int C = Size(rng) + groups, T = Size(rng) + groups;
+       Dense(
+           c, rng, C, T, 1,
+           [&](int i, int j) {
+             return i % groups == j % groups
+                        ? Uniform(rng, 0, 100)
+                        : numeric_limits<double>::infinity();
+           },
+           0.1);
+     }},
+    // Huge ids which have to be remapped to dense indices.
+    {"sparse_ids",
+     [](Case &c, Rng &rng) {
+       Case dense;
+       Dense(dense, rng, Size(rng), Size(rng), Density(rng),
+             [&](int, int) { return Uniform(rng, 0, 100); });
+       vector<int> character_ids(dense.num_characters);
+       vector<int> task_ids(dense.num_tasks);
+       for (int &id : character_ids) {
+         id = Uniform(rng, 0, 1 << 30);
+       }
+       for (int &id : task_ids) {
+         id = Uniform(rng, 0, 1 << 30);
+       }
+       for (auto &a : dense.assignments) {
+         c.assignments.push_back(
+             {character_ids[a.character], task_ids[a.task], a.cost});
+       }
+     }},
+    // The same pair listed many times with different costs.
+    {"duplicates",
+     [](Case &c, Rng &rng) {
+       Dense(c, rng, Size(rng), Size(rng), Density(rng),
+             [&](int, int) { return Uniform(rng, 0, 100); });
+       int n = c.assignments.size();
+       for (int i = 0; i < n; ++i) {
+         if (Chance(rng, 0.5)) {
+           auto a = c.assignments[i];
+           a.cost = Uniform(rng, 0, 100);
+           c.assignments.push_back(a);
+         }
+       }
+       shuffle(c.assignments.begin(), c.assignments.end(), rng);
+       c.matrix.clear();
+     }},
+    // Fractional costs (rounded for the integer types).
+    {"fractional",
+     [](Case &c, Rng &rng) {
+       Dense(c, rng, Size(rng), Size(rng), Density(rng), [&](int, int) {
+         return uniform_real_distribution<double>(0, 10)(rng);
+       });
+     }},
+};
+
+// Cost in the given type. Integer types get rounded costs. Infinite costs
+// stay infinite.
+template <typename Cost> Cost Convert(double cost) {
+  if (is_integral_v<Cost>) {
+    return colony::FixedPointCost<Cost>(cost, 1);
+  }
+  return cost;
+}
+
+template <typename Cost> bool IsPossible(Cost cost) {
+  return cost < colony::CostTraits<Cost>::Infinity();
+}
+
+// Total of `max_cost - cost` over the given assignments.
+template <typename Cost>
+long double Value(const vector<BasicAssignment<Cost>> &assignments,
+                  long double max_cost) {
+  long double value = 0;
+  for (auto &a : assignments) {
+    value += max_cost - a.cost;
+  }
+  return value;
+}
+
+template <typename Cost>
+long double MaxCost(const vector<BasicAssignment<Cost>> &assignments) {
+  long double max_cost = 0;
+  for (auto &a : assignments) {
+    if (IsPossible(a.cost)) {
+      max_cost = max<long double>(max_cost, a.cost);
+    }
+  }
+  return max_cost;
+}
+
+// Cheapest copy of each pair.
+template <typename Cost>
+vector<BasicAssignment<Cost>>
+Unique(vector<BasicAssignment<Cost>> assignments) {
+  sort(assignments.begin(), assignments.end(), [](auto &a, auto &b) {
+    return tie(a.character, a.task, a.cost) < tie(b.character, b.task, b.cost);
+  });
+  assignments.erase(unique(assignments.begin(), assignments.end(),
+                           [](auto &a, auto &b) {
+                             return a.character == b.character &&
+                                    a.task == b.task;
+                           }),
+                    assignments.end());
+  return assignments;
+}
+
+// Weights (`max_cost - cost`) of the cheapest copy of each possible pair
+// between the densely renumbered characters (rows) & tasks (columns).
+struct Weights {
+  int rows = 0, columns = 0;
+  vector<long double> w; // 0 for the missing pairs
+};
+
+template <typename Cost>
+Weights MakeWeights(const vector<BasicAssignment<Cost>> &assignments,
+                    long double max_cost) {
+  map<int, int> rows, columns;
+  for (auto &a : assignments) {
+    if (IsPossible(a.cost)) {
+      rows.emplace(a.character, rows.size());
+      columns.emplace(a.task, columns.size());
+    }
+  }
+  Weights weights;
+  weights.rows = rows.size();
+  weights.columns = columns.size();
+  weights.w.assign(weights.rows * weights.columns, 0);
+  for (auto &a : assignments) {
+    if (!IsPossible(a.cost)) {
+      continue;
+    }
+    long double &w = weights.w[rows[a.character] * weights.columns +
+                               columns[a.task]];
+    w = max(w, max_cost - a.cost);
+  }
+  return weights;
+}
+
+template <typename Cost>
+Weights MakeWeights(const vector<BasicAssignment<Cost>> &assignments) {
+  return MakeWeights(assignments, MaxCost(assignments));
+}
+
+// Simple O(n^2 * m) Hungarian algorithm (with potentials) that finds the
+// heaviest matching. Missing pairs weigh 0 & all of the weights are
+// non-negative - so it's enough to match each row of the smaller side.
+long double Reference(const Weights &weights) {
+  int n = weights.rows, m = weights.columns;
+  bool transpose = n > m;
+  if (transpose) {
+    swap(n, m);
+  }
+  auto cost = [&](int i, int j) { // 1-based, minimized
+    return -(transpose ? weights.w[(j - 1) * weights.columns + (i - 1)]
+                       : weights.w[(i - 1) * weights.columns + (j - 1)]);
+  };
+  const long double kInf = numeric_limits<long double>::infinity();
+  vector<long double> u(n + 1), v(m + 1);
+  vector<int> p(m + 1), way(m + 1);
+  for (int i = 1; i <= n; ++i) {
+    p[0] = i;
+    int j0 = 0;
+    vector<long double> minv(m + 1, kInf);
+    vector<char> used(m + 1, false);
+    do {
+      used[j0] = true;
+      int i0 = p[j0], j1 = 0;
+      long double delta = kInf;
+      for (int j = 1; j <= m; ++j) {
+        if (!used[j]) {
+          long double cur = cost(i0, j) - u[i0] - v[j];
+          if (cur < minv[j]) {
+            minv[j] = cur, way[j] = j0;
+          }
+          if (minv[j] < delta) {
+            delta = minv[j], j1 = j;
+          }
+        }
+      }
+      for (int j = 0; j <= m; ++j) {
+        if (used[j]) {
+          u[p[j]] += delta, v[j] -= delta;
+        } else {
+          minv[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (p[j0] != 0);
+    do {
+      int j1 = way[j0];
+      p[j0] = p[j1];
+      j0 = j1;
+    } while (j0);
+  }
+  long double total = 0;
+  for (int j = 1; j <= m; ++j) {
+    if (p[j]) {
+      total -= cost(p[j], j);
+    }
+  }
+  return total;
+}
+
+// Tries every matching. Only for the tiny problems.
+long double BruteForce(const Weights &weights, int row, vector<char> &used) {
+  if (row == weights.rows) {
+    return 0;
+  }
+  long double best = BruteForce(weights, row + 1, used); // row unassigned
+  for (int j = 0; j < weights.columns; ++j) {
+    long double w = weights.w[row * weights.columns + j];
+    if (!used[j] && w > 0) {
+      used[j] = true;
+      best = max(best, w + BruteForce(weights, row + 1, used));
+      used[j] = false;
+    }
+  }
+  return best;
+}
+
+// Potential assignment of the capacitated brute force.
+struct Edge {
+  int character, task;
+  long double weight;
+};
+
+// Tries every subset of the edges that fits into the units of the characters
+// & tasks. Only for the tiny problems.
+long double BruteForce(const vector<Edge> &edges, size_t i,
+                       map<int, int> &character_units,
+                       map<int, int> &task_units) {
+  if (i == edges.size()) {
+    return 0;
+  }
+  long double best = BruteForce(edges, i + 1, character_units, task_units);
+  const Edge &e = edges[i];
+  int &character = character_units[e.character], &task = task_units[e.task];
+  if (e.weight > 0 && character > 0 && task > 0) {
+    --character, --task;
+    best = max(best, e.weight +
+                         BruteForce(edges, i + 1, character_units, task_units));
+    ++character, ++task;
+  }
+  return best;
+}
+
+int failures = 0;
+int checks = 0;
+
+template <typename Cost> const char *CostName() {
+  if (is_same_v<Cost, double>) {
+    return "double";
+  } else if (is_same_v<Cost, float>) {
+    return "float";
+  } else if (is_same_v<Cost, int32_t>) {
+    return "int32";
+  }
+  return "int64";
+}
+
+// Labels of the solvers are compared with a tolerance (see `CostTraits`) so
+// floating point results may be off by a little per assigned pair.
+template <typename Cost>
+long double Tolerance(long double expected, int pairs) {
+  if (is_integral_v<Cost>) {
+    return 0;
+  }
+  return 1e-3L * (pairs + 1) * max<long double>(1, fabsl(expected) / 100);
+}
+
+void Fail(const Case &c, const char *cost_name, const char *solver,
+          const char *what, long double expected, long double actual) {
+  ++failures;
+  if (failures <= 50) {
+    printf("FAIL %s/%s/%s seed=%" PRIu64 ": %s (expected %.6Lf, got %.6Lf)\n",
+           c.generator, cost_name, solver, c.seed, what, expected, actual);
+  }
+}
+
+// Checks that `output` is a valid solution of `input`.
+template <typename Cost>
+bool Valid(const Case &c, const char *solver,
+           const vector<BasicAssignment<Cost>> &input,
+           const vector<BasicAssignment<Cost>> &output) {
+  ++checks;
+  const char *cost_name = CostName<Cost>();
+  map<pair<int, int>, Cost> cheapest;
+  for (auto &a : input) {
+    if (!IsPossible(a.cost)) {
+      continue;
+    }
+    auto [it, inserted] = cheapest.try_emplace({a.character, a.task}, a.cost);
+    if (!inserted) {
+      it->second = min(it->second, a.cost);
+    }
+  }
+  set<int> characters, tasks;
+  auto fail = [&](const char *what, long double expected, long double actual) {
+    Fail(c, cost_name, solver, what, expected, actual);
+    return false;
+  };
+  for (auto &a : output) {
+    if (!IsPossible(a.cost)) {
+      return fail("impossible pair assigned", a.character, a.task);
+    }
+    auto it = cheapest.find({a.character, a.task});
+    if (it == cheapest.end()) {
+      return fail("pair not in the input", a.character, a.task);
+    }
+    if (it->second != a.cost) {
+      return fail("not the cheapest copy of a pair", it->second, a.cost);
+    }
+    if (!characters.insert(a.character).second) {
+      return fail("character assigned twice", 0, a.character);
+    }
+    if (!tasks.insert(a.task).second) {
+      return fail("task assigned twice", 0, a.task);
+    }
+  }
+  return true;
+}
+
+// Checks that `output` is a valid & optimal solution of `input`. Missing pairs
+// cost `max_cost`.
+template <typename Cost>
+void Check(const Case &c, const char *solver,
+           const vector<BasicAssignment<Cost>> &input,
+           const vector<BasicAssignment<Cost>> &output, long double expected,
+           long double max_cost) {
+  if (!Valid(c, solver, input, output)) {
+    return;
+  }
+  long double actual = Value(output, max_cost);
+  if (fabsl(actual - expected) >
+      Tolerance<Cost>(expected, (int)output.size())) {
+    Fail(c, CostName<Cost>(), solver, "total differs from the reference",
+         expected, actual);
+  }
+}
+
+template <typename Cost>
+void Check(const Case &c, const char *solver,
+           const vector<BasicAssignment<Cost>> &input,
+           const vector<BasicAssignment<Cost>> &output, long double expected) {
+  Check(c, solver, input, output, expected, MaxCost(input));
+}
+
+// Solvers keep their workspaces across cases - like games keep them across
+// frames. Each solver has its own workspace so that the warm start of
+// `Reoptimize` sees the problems of the previous cases.
+template <typename Cost> struct Solvers {
+  colony::ThreadPool pool{4};
+  colony::BasicWorkspace<Cost> dense, sparse, auction, automatic, whole,
+      deterministic, parallel, columns, reoptimize, capacitated, matrix, timed,
+      anytime, switching, limit;
+  colony::BasicBatchWorkspace<Cost> batch;
+  colony::BasicAssignmentBuffer<Cost> buffer;
+  colony::BasicTieredWorkspace<Cost> tiered;
+  // Solvers that only take `double` costs.
+  colony::ZoneWorkspace zones;
+  colony::HaulingWorkspace hauling;
+  colony::Workspace plan;
+
+  Solvers() {
+    whole.split_components = false;
+    deterministic.deterministic = true;
+    limit.deterministic = true;
+    parallel.executor = pool.AsExecutor();
+    parallel.columns_per_job = 8;
+    batch.executor = pool.AsExecutor();
+    zones.measure_gap = true;
+    zones.zones.executor = pool.AsExecutor();
+  }
+
+  typedef vector<BasicAssignment<Cost>> Rows;
+
+  void Run(const Case &c, Rng &rng) {
+    using namespace colony;
+    Rows input;
+    for (auto &a : c.assignments) {
+      input.push_back({a.character, a.task, Convert<Cost>(a.cost)});
+    }
+    Weights weights = MakeWeights(input);
+    long double expected = Reference(weights);
+    if (weights.rows <= 7 && weights.columns <= 7) {
+      vector<char> used(weights.columns);
+      long double brute = BruteForce(weights, 0, used);
+      if (fabsl(brute - expected) > 1e-6) {
+        Fail(c, CostName<Cost>(), "reference", "differs from brute force",
+             brute, expected);
+      }
+    }
+
+    auto check = [&](const char *solver, auto &&solve) {
+      Rows output = input;
+      solve(output);
+      Check(c, solver, input, output, expected);
+    };
+    check("dense", [&](Rows &rows) { Optimize(rows, dense); });
+    check("sparse",
+          [&](Rows &rows) { Optimize(rows, Engine::Sparse, sparse); });
+    check("auction",
+          [&](Rows &rows) { Optimize(rows, Engine::Auction, auction); });
+    check("auto", [&](Rows &rows) { Optimize(rows, Engine::Auto, automatic); });
+    check("whole", [&](Rows &rows) { Optimize(rows, whole); });
+    check("parallel", [&](Rows &rows) { Optimize(rows, parallel); });
+    check("reoptimize", [&](Rows &rows) { Reoptimize(rows, reoptimize); });
+    check("deadline", [&](Rows &rows) {
+      if (!Optimize(rows, Deadline::max(), timed)) {
+        Fail(c, CostName<Cost>(), "deadline", "not optimal", 1, 0);
+      }
+    });
+    check("reoptimize_deadline", [&](Rows &rows) {
+      if (!Reoptimize(rows, Deadline::max(), reoptimize)) {
+        Fail(c, CostName<Cost>(), "reoptimize_deadline", "not optimal", 1, 0);
+      }
+    });
+    check("deterministic", [&](Rows &rows) {
+      Optimize(rows, deterministic);
+      // The same pairs in a different order give the same result.
+      Rows shuffled = input;
+      shuffle(shuffled.begin(), shuffled.end(), rng);
+      Optimize(shuffled, deterministic);
+      bool same = shuffled.size() == rows.size();
+      for (size_t i = 0; same && i < rows.size(); ++i) {
+        same = rows[i].character == shuffled[i].character &&
+               rows[i].task == shuffled[i].task;
+      }
+      if (!same) {
+        Fail(c, CostName<Cost>(), "deterministic", "depends on the order",
+             rows.size(), shuffled.size());
+      }
+    });
+    check("columns", [&](Rows &rows) {
+      vector<uint32_t> characters, tasks;
+      vector<Cost> costs;
+      for (auto &a : input) {
+        characters.push_back(a.character);
+        tasks.push_back(a.task);
+        costs.push_back(a.cost);
+      }
+      Optimize<Cost>({characters, tasks, costs}, buffer, columns);
+      rows.clear();
+      for (size_t i = 0; i < buffer.size(); ++i) {
+        rows.push_back(buffer[i]);
+      }
+    });
+    check("batch", [&](Rows &rows) {
+      // The same problem twice with an empty one in between.
+      BasicProblem<Cost> problems[] = {{input}, {}, {input}};
+      vector<int> offsets;
+      OptimizeBatch<Cost>(problems, rows, offsets, batch);
+      Rows first(rows.begin() + offsets[0], rows.begin() + offsets[1]);
+      Rows second(rows.begin() + offsets[2], rows.begin() + offsets[3]);
+      Check(c, "batch", input, first, expected);
+      if (offsets[1] != offsets[2]) {
+        Fail(c, CostName<Cost>(), "batch", "empty problem got assignments", 0,
+             offsets[2] - offsets[1]);
+      }
+      rows = second;
+    });
+    {
+      // The scheduler keeps one cost per pair - so the expensive copies of
+      // the duplicated pairs don't raise its maximum cost.
+      Rows pairs = Unique(input);
+      BasicScheduler<Cost> scheduler;
+      for (auto &a : pairs) {
+        scheduler.UpdateCost(a.character, a.task, a.cost);
+      }
+      Rows rows = scheduler.Solve();
+      Check(c, "scheduler", pairs, rows, Reference(MakeWeights(pairs)));
+    }
+    check("capacitated", [&](Rows &rows) {
+      OptimizeCapacitated<Cost>(rows, {}, {}, capacitated);
+    });
+    if (!c.matrix.empty()) {
+      auto cost = [&](int i, int j) {
+        return Convert<Cost>(c.matrix[i * c.num_tasks + j]);
+      };
+      check("matrix", [&](Rows &rows) {
+        Optimize(c.num_characters, c.num_tasks, cost, rows, matrix);
+      });
+      check("matrix_reoptimize", [&](Rows &rows) {
+        Reoptimize(c.num_characters, c.num_tasks, cost, rows, matrix);
+      });
+    }
+    check("limit", [&](Rows &rows) {
+      // Limits that keep every pair don't change the optimum.
+      int n = rows.size();
+      LimitAssignments<Cost>(rows, n, n, limit);
+      Optimize(rows, limit);
+    });
+
+    Anytime(c, input, expected);
+    Switching(c, rng, input);
+    Capacities(c, rng, input);
+    Tiers(c, rng, input);
+    Limits(c, rng, input);
+    if constexpr (is_same_v<Cost, double>) {
+      Zones(c, rng, input, expected);
+      Hauling(c, rng);
+      Plans(c);
+    }
+    Frames(c, rng, input);
+  }
+
+  // Some pairs of `input` that form a valid assignment.
+  static Rows RandomMatching(Rng &rng, Rows input) {
+    shuffle(input.begin(), input.end(), rng);
+    set<int> characters, tasks;
+    Rows matching;
+    for (auto &a : input) {
+      if (IsPossible(a.cost) && Chance(rng, 0.5) &&
+          characters.insert(a.character).second &&
+          tasks.insert(a.task).second) {
+        matching.push_back(a);
+      }
+    }
+    return matching;
+  }
+
+  // A deadline that has already passed still gives a valid assignment that
+  // leaves no worthwhile pair with both of its ends free. Repeated calls of
+  // `Reoptimize` augment at least one path each & reach the optimum.
+  void Anytime(const Case &c, const Rows &input, long double expected) {
+    using namespace colony;
+    const Deadline past = Deadline::min();
+    long double max_cost = MaxCost(input);
+    auto complete = [&](const char *solver, const Rows &rows) {
+      if (!Valid(c, solver, input, rows)) {
+        return false;
+      }
+      set<int> characters, tasks;
+      for (auto &a : rows) {
+        characters.insert(a.character);
+        tasks.insert(a.task);
+      }
+      for (auto &a : input) {
+        if (IsPossible(a.cost) && a.cost < max_cost &&
+            !characters.count(a.character) && !tasks.count(a.task)) {
+          Fail(c, CostName<Cost>(), solver, "worthwhile pair left out",
+               a.character, a.task);
+          return false;
+        }
+      }
+      return true;
+    };
+    Rows rows = input;
+    bool optimal = Optimize(rows, past, anytime);
+    if (!complete("anytime", rows)) {
+      return;
+    }
+    if (optimal) {
+      Check(c, "anytime", input, rows, expected);
+    }
+    for (size_t calls = 0;; ++calls) {
+      rows = input;
+      if (Reoptimize(rows, past, anytime)) {
+        break;
+      }
+      if (!complete("anytime_reoptimize", rows)) {
+        return;
+      }
+      // Recycled sparse ids can make the matrix bigger than the input.
+      size_t size = std::max(anytime.NX, anytime.NY);
+      if (calls > size) {
+        return Fail(c, CostName<Cost>(), "anytime_reoptimize",
+                    "doesn't converge", size, calls);
+      }
+    }
+    Check(c, "anytime_reoptimize", input, rows, expected);
+  }
+
+  // The incumbent pairs of a random previous assignment are cheaper by the
+  // penalty. The output keeps the original costs.
+  void Switching(const Case &c, Rng &rng, const Rows &input) {
+    using namespace colony;
+    Rows previous = RandomMatching(rng, input);
+    Cost penalty = Chance(rng, 0.25) ? 0 : Convert<Cost>(Uniform(rng, 1, 50));
+    set<pair<int, int>> incumbents;
+    for (auto &a : previous) {
+      incumbents.insert({a.character, a.task});
+    }
+    auto stable = [&](Rows rows) {
+      for (auto &a : rows) {
+        if (IsPossible(a.cost) && incumbents.count({a.character, a.task})) {
+          a.cost -= penalty;
+        }
+      }
+      return rows;
+    };
+    Rows stable_input = stable(input);
+    long double expected = Reference(MakeWeights(stable_input));
+    auto check = [&](const char *solver, auto &&solve) {
+      Rows rows = input;
+      solve(rows);
+      Check(c, solver, stable_input, stable(rows), expected);
+    };
+    check("switching", [&](Rows &rows) {
+      Optimize<Cost>(rows, previous, penalty, switching);
+    });
+    check("reoptimize_switching", [&](Rows &rows) {
+      Reoptimize<Cost>(rows, previous, penalty, switching);
+    });
+    if (c.matrix.empty()) {
+      return;
+    }
+    auto cost = [&](int i, int j) {
+      return Convert<Cost>(c.matrix[i * c.num_tasks + j]);
+    };
+    check("matrix_switching", [&](Rows &rows) {
+      Optimize<Cost>(c.num_characters, c.num_tasks, cost, previous, penalty,
+                     rows, switching);
+    });
+    check("matrix_reoptimize_switching", [&](Rows &rows) {
+      Reoptimize<Cost>(c.num_characters, c.num_tasks, cost, previous, penalty,
+                       rows, switching);
+    });
+  }
+
+  // Random capacities (0 to 3 units, ids past the end of the spans have 1).
+  // Each pair is assigned at most once & nobody takes more pairs than their
+  // units. Small problems are compared with brute force.
+  void Capacities(const Case &c, Rng &rng, const Rows &input) {
+    using namespace colony;
+    const char *cost_name = CostName<Cost>();
+    int max_character = -1, max_task = -1;
+    for (auto &a : input) {
+      max_character = max(max_character, a.character);
+      max_task = max(max_task, a.task);
+    }
+    vector<int> character_capacity, task_capacity;
+    if (max_character < 1000 && max_task < 1000) {
+      character_capacity.resize(Uniform(rng, 0, max_character + 1));
+      task_capacity.resize(Uniform(rng, 0, max_task + 1));
+    }
+    for (int &units : character_capacity) {
+      units = Uniform(rng, 0, 3);
+    }
+    for (int &units : task_capacity) {
+      units = Uniform(rng, 0, 3);
+    }
+    auto units = [](const vector<int> &capacity, int id) {
+      return id < (int)capacity.size() ? capacity[id] : 1;
+    };
+    Rows rows = input;
+    OptimizeCapacitated<Cost>(rows, character_capacity, task_capacity,
+                              capacitated);
+    ++checks;
+    map<pair<int, int>, Cost> cheapest;
+    for (auto &a : input) {
+      if (IsPossible(a.cost)) {
+        auto [it, inserted] = cheapest.try_emplace({a.character, a.task},
+                                                   a.cost);
+        it->second = min(it->second, a.cost);
+      }
+    }
+    set<pair<int, int>> assigned;
+    map<int, int> character_pairs, task_pairs;
+    for (auto &a : rows) {
+      auto it = cheapest.find({a.character, a.task});
+      if (it == cheapest.end()) {
+        return Fail(c, cost_name, "capacities", "pair not in the input",
+                    a.character, a.task);
+      }
+      if (it->second != a.cost) {
+        return Fail(c, cost_name, "capacities",
+                    "not the cheapest copy of a pair", it->second, a.cost);
+      }
+      if (!assigned.insert({a.character, a.task}).second) {
+        return Fail(c, cost_name, "capacities", "pair assigned twice",
+                    a.character, a.task);
+      }
+      if (++character_pairs[a.character] >
+          units(character_capacity, a.character)) {
+        return Fail(c, cost_name, "capacities", "character over capacity",
+                    units(character_capacity, a.character),
+                    character_pairs[a.character]);
+      }
+      if (++task_pairs[a.task] > units(task_capacity, a.task)) {
+        return Fail(c, cost_name, "capacities", "task over capacity",
+                    units(task_capacity, a.task), task_pairs[a.task]);
+      }
+    }
+    if (cheapest.size() > 12) {
+      return;
+    }
+    long double max_cost = MaxCost(input);
+    vector<Edge> edges;
+    map<int, int> character_units, task_units;
+    for (auto &[pair, cost] : cheapest) {
+      edges.push_back({pair.first, pair.second, max_cost - cost});
+      character_units[pair.first] = units(character_capacity, pair.first);
+      task_units[pair.second] = units(task_capacity, pair.second);
+    }
+    long double expected =
+        BruteForce(edges, 0, character_units, task_units);
+    long double actual = Value(rows, max_cost);
+    if (fabsl(actual - expected) >
+        Tolerance<Cost>(expected, (int)rows.size())) {
+      Fail(c, cost_name, "capacities", "differs from brute force", expected,
+           actual);
+    }
+  }
+
+  // Each tier must be optimal for the characters left by the previous tiers.
+  // A missing pair costs as much as the most expensive pair of its tier.
+  void Tiers(const Case &c, Rng &rng, const Rows &input) {
+    using namespace colony;
+    // Cases without a matrix have all of their tasks in tier 0.
+    vector<int> task_tier(c.num_tasks);
+    for (int &tier : task_tier) {
+      tier = Uniform(rng, 0, 2);
+    }
+    auto tier_of = [&](int task) {
+      return task < (int)task_tier.size() ? task_tier[task] : 0;
+    };
+    Rows rows = input;
+    OptimizeTiered<Cost>(rows, task_tier, tiered);
+    set<int> taken;
+    for (int tier = 0; tier < 3; ++tier) {
+      Rows all_pairs, tier_input, tier_output;
+      for (auto &a : input) {
+        if (tier_of(a.task) == tier) {
+          all_pairs.push_back(a);
+          if (!taken.count(a.character)) {
+            tier_input.push_back(a);
+          }
+        }
+      }
+      long double max_cost = MaxCost(all_pairs);
+      for (auto &a : rows) {
+        if (tier_of(a.task) == tier) {
+          tier_output.push_back(a);
+          taken.insert(a.character);
+        }
+      }
+      Check(c, "tiered", tier_input, tier_output,
+            Reference(MakeWeights(tier_input, max_cost)), max_cost);
+    }
+  }
+
+  // Tight limits keep at most the given number of pairs per character & task
+  // no matter the order of the input.
+  void Limits(const Case &c, Rng &rng, const Rows &input) {
+    using namespace colony;
+    const char *cost_name = CostName<Cost>();
+    int per_character = Uniform(rng, 0, 3), per_task = Uniform(rng, 0, 3);
+    Rows rows = input;
+    LimitAssignments<Cost>(rows, per_character, per_task, limit);
+    ++checks;
+    map<int, int> characters, tasks;
+    for (auto &a : rows) {
+      if (++characters[a.character] > per_character) {
+        return Fail(c, cost_name, "limit_tight",
+                    "too many pairs of a character", per_character,
+                    characters[a.character]);
+      }
+      if (++tasks[a.task] > per_task) {
+        return Fail(c, cost_name, "limit_tight", "too many pairs of a task",
+                    per_task, tasks[a.task]);
+      }
+    }
+    auto key = [](auto &a) { return tie(a.character, a.task, a.cost); };
+    auto sorted = [&](Rows r) {
+      sort(r.begin(), r.end(),
+           [&](auto &a, auto &b) { return key(a) < key(b); });
+      return r;
+    };
+    Rows kept = sorted(rows), all = sorted(input);
+    if (!includes(all.begin(), all.end(), kept.begin(), kept.end(),
+                  [&](auto &a, auto &b) { return key(a) < key(b); })) {
+      return Fail(c, cost_name, "limit_tight", "pair not in the input", 0, 0);
+    }
+    Rows shuffled = input;
+    shuffle(shuffled.begin(), shuffled.end(), rng);
+    LimitAssignments<Cost>(shuffled, per_character, per_task, limit);
+    bool same = shuffled.size() == rows.size();
+    for (size_t i = 0; same && i < rows.size(); ++i) {
+      same = key(rows[i]) == key(shuffled[i]);
+    }
+    if (!same) {
+      return Fail(c, cost_name, "limit_tight", "depends on the order",
+                  rows.size(), shuffled.size());
+    }
+    // Indices that `Reoptimize` keeps across frames stay the same.
+    auto indices = [&] {
+      vector<int> result;
+      for (auto &a : input) {
+        result.push_back(reoptimize.character_ids.Find(a.character));
+        result.push_back(reoptimize.task_ids.Find(a.task));
+      }
+      return result;
+    };
+    vector<int> before = indices();
+    Rows half(input.begin(), input.begin() + input.size() / 2);
+    LimitAssignments<Cost>(half, per_character, per_task, reoptimize);
+    ++checks;
+    if (indices() != before) {
+      return Fail(c, cost_name, "limit_tight", "changed the id maps", 0, 0);
+    }
+    if (c.matrix.empty()) {
+      return;
+    }
+    // The variant with a cost function skips the impossible pairs.
+    Rows possible = input;
+    erase_if(possible, [](auto &a) { return !IsPossible(a.cost); });
+    LimitAssignments<Cost>(possible, per_character, per_task, limit);
+    Rows from_matrix;
+    LimitAssignments<Cost>(
+        c.num_characters, c.num_tasks,
+        [&](int i, int j) {
+          return Convert<Cost>(c.matrix[i * c.num_tasks + j]);
+        },
+        per_character, per_task, from_matrix, limit);
+    same = from_matrix.size() == possible.size();
+    for (size_t i = 0; same && i < possible.size(); ++i) {
+      same = key(possible[i]) == key(from_matrix[i]);
+    }
+    if (!same) {
+      Fail(c, cost_name, "limit_matrix", "differs from the vector variant",
+           possible.size(), from_matrix.size());
+    }
+  }
+
+  // Zones aren't optimal (even a single one - its characters are picked by
+  // their cheapest pairs) but they're valid & report their gap.
+  void Zones(const Case &c, Rng &rng, const Rows &input,
+             long double expected) {
+    using namespace colony;
+    // Cases without a matrix have all of their tasks in `kNoZone`.
+    vector<int> task_zone(c.num_tasks);
+    int num_zones = Uniform(rng, 1, 3);
+    for (int &zone : task_zone) {
+      zone = Uniform(rng, 0, num_zones - 1);
+    }
+    Rows rows = input;
+    OptimizeZones(rows, task_zone, zones);
+    if (!Valid(c, "zones", input, rows)) {
+      return;
+    }
+    long double actual = Value(rows, MaxCost(input));
+    long double tolerance = Tolerance<double>(expected, (int)rows.size());
+    if (actual > expected + tolerance) {
+      Fail(c, "double", "zones", "better than the optimum", expected, actual);
+    } else if (fabsl(zones.gap - (expected - actual)) > tolerance) {
+      Fail(c, "double", "zones", "wrong gap", expected - actual, zones.gap);
+    }
+  }
+
+  // Both stages of hauling are optimal. Items & destinations come from the
+  // matrix of the case.
+  void Hauling(const Case &c, Rng &rng) {
+    using namespace colony;
+    if (c.matrix.empty()) {
+      return;
+    }
+    const double inf = numeric_limits<double>::infinity();
+    int num_haulers = Uniform(rng, 0, 8);
+    vector<double> pickup(num_haulers * c.num_characters);
+    for (double &cost : pickup) {
+      cost = Chance(rng, 0.2) ? inf : Uniform(rng, 0, 100);
+    }
+    auto delivery_cost = [&](int item, int destination) {
+      return c.matrix[item * c.num_tasks + destination];
+    };
+    auto pickup_cost = [&](int hauler, int item) {
+      return pickup[hauler * c.num_characters + item];
+    };
+    vector<Haul> hauls;
+    OptimizeHauling(c.num_characters, c.num_tasks, num_haulers, delivery_cost,
+                    pickup_cost, hauls, hauling);
+    Rows items;
+    for (int i = 0; i < c.num_characters; ++i) {
+      for (int j = 0; j < c.num_tasks; ++j) {
+        items.push_back({i, j, delivery_cost(i, j)});
+      }
+    }
+    auto &delivery = hauling.delivery;
+    Check(c, "hauling_deliveries", items, delivery,
+          Reference(MakeWeights(items)));
+    Rows haulers;
+    for (int h = 0; h < num_haulers; ++h) {
+      for (int d = 0; d < (int)delivery.size(); ++d) {
+        haulers.push_back(
+            {h, d, pickup_cost(h, delivery[d].character) + delivery[d].cost});
+      }
+    }
+    Check(c, "hauling_haulers", haulers, hauling.hauler,
+          Reference(MakeWeights(haulers)));
+    ++checks;
+    bool same = hauls.size() == hauling.hauler.size();
+    for (size_t i = 0; same && i < hauls.size(); ++i) {
+      auto &a = hauling.hauler[i];
+      same = hauls[i].character == a.character && hauls[i].cost == a.cost &&
+             hauls[i].item == delivery[a.task].character &&
+             hauls[i].destination == delivery[a.task].task;
+    }
+    if (!same) {
+      Fail(c, "double", "hauling", "hauls differ from the stages",
+           hauling.hauler.size(), hauls.size());
+    }
+  }
+
+  // Plans of depth 1 are an optimal assignment. Deeper plans do every task at
+  // most once & only when it's possible after the previous task of the plan.
+  void Plans(const Case &c) {
+    using namespace colony;
+    if (c.matrix.empty()) {
+      return;
+    }
+    const double inf = numeric_limits<double>::infinity();
+    auto cost = [&](int character, int after, int task) {
+      double cost = c.matrix[character * c.num_tasks + task];
+      return after == -1 ? cost
+             : (after + task) % 5 == 0 ? inf
+                                       : cost + abs(after - task);
+    };
+    vector<vector<TaskId>> plans;
+    PlanAhead(c.num_characters, c.num_tasks, cost, 1e9, 1, plans, plan);
+    Rows input, rows;
+    for (int i = 0; i < c.num_characters; ++i) {
+      for (int j = 0; j < c.num_tasks; ++j) {
+        input.push_back({i, j, cost(i, -1, j)});
+      }
+      for (int task : plans[i]) {
+        rows.push_back({i, task, cost(i, -1, task)});
+      }
+    }
+    Check(c, "plan", input, rows, Reference(MakeWeights(input)));
+    PlanAhead(c.num_characters, c.num_tasks, cost, 1e9, 3, plans, plan);
+    ++checks;
+    set<int> done;
+    for (int i = 0; i < c.num_characters; ++i) {
+      if (plans[i].size() > 3) {
+        return Fail(c, "double", "plan_deep", "plan too long", 3,
+                    plans[i].size());
+      }
+      int after = -1;
+      for (int task : plans[i]) {
+        if (!done.insert(task).second) {
+          return Fail(c, "double", "plan_deep", "task planned twice", 0, task);
+        }
+        if (!(cost(i, after, task) < inf)) {
+          return Fail(c, "double", "plan_deep", "impossible step", after, task);
+        }
+        after = task;
+      }
+    }
+    PlanExpired(c, cost);
+  }
+
+  // A budget that runs out right after the first completed task leaves the
+  // final assignment to the greedy completion. It's still valid & leaves out
+  // no worthwhile pair whose character & task are both free.
+  template <typename CostFn> void PlanExpired(const Case &c, CostFn &cost) {
+    using namespace colony;
+    const double inf = numeric_limits<double>::infinity();
+    int busy = -1, done_task = -1; // character that completed a task
+    auto slow = [&](int character, int after, int task) {
+      if (after != -1 && busy == -1) {
+        busy = character, done_task = after;
+        this_thread::sleep_for(chrono::milliseconds(3));
+      }
+      return cost(character, after, task);
+    };
+    vector<vector<TaskId>> plans;
+    PlanAhead(c.num_characters, c.num_tasks, slow, 2000, 2, plans, plan);
+    ++checks;
+    auto total = [&](int character, int task) {
+      if (task == done_task) {
+        return inf;
+      }
+      return character == busy ? cost(character, -1, done_task) +
+                                     cost(character, done_task, task)
+                               : cost(character, -1, task);
+    };
+    double U = 0;
+    for (int i = 0; i < c.num_characters; ++i) {
+      for (int j = 0; j < c.num_tasks; ++j) {
+        if (total(i, j) < inf) {
+          U = max(U, total(i, j));
+        }
+      }
+    }
+    vector<int> final_task(c.num_characters, -1);
+    set<int> tasks;
+    for (int i = 0; i < c.num_characters; ++i) {
+      if (plans[i].size() > (i == busy ? 1u : 0u)) {
+        final_task[i] = plans[i].back();
+        if (!(total(i, final_task[i]) < inf)) {
+          return Fail(c, "double", "plan_expired", "impossible pair", i,
+                      final_task[i]);
+        }
+        if (!tasks.insert(final_task[i]).second) {
+          return Fail(c, "double", "plan_expired", "task planned twice", 0,
+                      final_task[i]);
+        }
+      }
+    }
+    for (int i = 0; i < c.num_characters; ++i) {
+      for (int j = 0; j < c.num_tasks; ++j) {
+        if (final_task[i] == -1 && !tasks.count(j) && total(i, j) < U) {
+          return Fail(c, "double", "plan_expired", "worthwhile pair left out",
+                      i, j);
+        }
+      }
+    }
+  }
+
+  // Changes a few pairs at a time (like the frames of a game) & checks that
+  // the incremental solvers keep up.
+  void Frames(const Case &c, Rng &rng, Rows input) {
+    using namespace colony;
+    if (input.empty()) {
+      return;
+    }
+    input = Unique(input); // the scheduler keeps one cost per pair
+    // The second scheduler is deterministic. Its results must match the ones
+    // of a fresh scheduler that gets the pairs in a different order.
+    BasicScheduler<Cost> schedulers[2];
+    schedulers[1].workspace.deterministic = true;
+    auto update = [&](CharacterId character, TaskId task, Cost cost) {
+      for (auto &scheduler : schedulers) {
+        scheduler.UpdateCost(character, task, cost);
+      }
+    };
+    for (auto &a : input) {
+      update(a.character, a.task, a.cost);
+    }
+    for (auto &scheduler : schedulers) {
+      scheduler.Solve();
+    }
+    for (int frame = 0; frame < 4 && !input.empty(); ++frame) {
+      for (int k = Uniform(rng, 1, 3); k > 0 && !input.empty(); --k) {
+        int i = Uniform(rng, 0, input.size() - 1);
+        auto &a = input[i];
+        int r = Uniform(rng, 0, 9);
+        if (r < 5) {
+          a.cost = Convert<Cost>(Uniform(rng, -10, 120));
+          update(a.character, a.task, a.cost);
+        } else if (r < 7) {
+          update(a.character, a.task, CostTraits<Cost>::Infinity());
+          input.erase(input.begin() + i);
+        } else if (r < 8) {
+          int character = a.character;
+          for (auto &scheduler : schedulers) {
+            scheduler.RemoveCharacter(character);
+          }
+          erase_if(input, [&](auto &b) { return b.character == character; });
+        } else if (r < 9) {
+          int task = a.task;
+          for (auto &scheduler : schedulers) {
+            scheduler.RemoveTask(task);
+          }
+          erase_if(input, [&](auto &b) { return b.task == task; });
+        } else {
+          // New task for an existing character.
+          int task = a.task + Uniform(rng, 1, 1000);
+          BasicAssignment<Cost> b{a.character, task,
+                                  Convert<Cost>(Uniform(rng, 0, 100))};
+          bool exists = false;
+          for (auto &other : input) {
+            exists |= other.character == b.character && other.task == b.task;
+          }
+          if (!exists) {
+            input.push_back(b);
+            update(b.character, b.task, b.cost);
+          }
+        }
+      }
+      long double expected = Reference(MakeWeights(input));
+      Rows rows = input;
+      Reoptimize(rows, reoptimize);
+      Check(c, "reoptimize_frames", input, rows, expected);
+      rows = schedulers[0].Solve();
+      Check(c, "scheduler_frames", input, rows, expected);
+      rows = schedulers[1].Solve();
+      Check(c, "scheduler_deterministic", input, rows, expected);
+      BasicScheduler<Cost> fresh;
+      fresh.workspace.deterministic = true;
+      Rows shuffled = input;
+      shuffle(shuffled.begin(), shuffled.end(), rng);
+      for (auto &a : shuffled) {
+        fresh.UpdateCost(a.character, a.task, a.cost);
+      }
+      ++checks;
+      const Rows &fresh_rows = fresh.Solve();
+      bool same = rows.size() == fresh_rows.size();
+      for (size_t j = 0; same && j < rows.size(); ++j) {
+        same = rows[j].character == fresh_rows[j].character &&
+               rows[j].task == fresh_rows[j].task;
+      }
+      if (!same) {
+        return Fail(c, CostName<Cost>(), "scheduler_deterministic",
+                    "depends on the history", rows.size(), fresh_rows.size());
+      }
+    }
+  }
+};
+
+template <typename Cost> void Test(const Options &options) {
+  Solvers<Cost> solvers;
+  int num_generators = sizeof(kGenerators) / sizeof(kGenerators[0]);
+  for (int i = 0; i < options.cases; ++i) {
+    Case c;
+    c.seed = options.seed + i;
+    Rng rng(c.seed);
+    const Generator &generator = kGenerators[c.seed % num_generators];
+    c.generator = generator.name;
+    generator.fill(c, rng);
+    if (options.verbose) {
+      printf("%s/%s seed=%" PRIu64 ": %d pairs\n", c.generator,
+             CostName<Cost>(), c.seed, (int)c.assignments.size());
+    }
+    solvers.Run(c, rng);
+  }
+}
+
+// `int64_t` costs close to the limit of their type (a few times below it).
+// The scaled prices of the auction would overflow, so it must fall back to an
+// exact engine. Shaped so that `Engine::Auto` picks the auction. Totals are
+// compared exactly with the dense solver.
+void HugeCosts(const Options &options) {
+  typedef vector<BasicAssignment<int64_t>> Rows;
+  colony::BasicWorkspace<int64_t> dense, sparse, auction, automatic;
+  const int64_t kMaxCost = numeric_limits<int64_t>::max() / 8 * 3;
+  for (int i = 0; i < 3; ++i) {
+    Case c;
+    c.generator = "huge_costs";
+    c.seed = options.seed + i;
+    Rng rng(c.seed);
+    Rows input;
+    for (int character = 0; character < 200; ++character) {
+      for (int k = 0; k < 5; ++k) {
+        int64_t cost =
+            uniform_int_distribution<int64_t>(kMaxCost / 2, kMaxCost)(rng);
+        input.push_back({character, Uniform(rng, 0, 199), cost});
+      }
+    }
+    int64_t max_cost = 0;
+    for (auto &a : input) {
+      max_cost = max(max_cost, a.cost);
+    }
+    auto total = [&](const Rows &rows) {
+      __int128 value = 0;
+      for (auto &a : rows) {
+        value += max_cost - a.cost;
+      }
+      return value;
+    };
+    Rows expected = input;
+    colony::Optimize(expected, colony::Engine::Dense, dense);
+    if (!Valid(c, "dense", input, expected)) {
+      continue;
+    }
+    auto check = [&](const char *solver, colony::Engine engine,
+                     colony::BasicWorkspace<int64_t> &ws) {
+      Rows rows = input;
+      colony::Optimize(rows, engine, ws);
+      if (Valid(c, solver, input, rows) && total(rows) != total(expected)) {
+        Fail(c, "int64", solver, "total differs from the dense solver",
+             (long double)total(expected), (long double)total(rows));
+      }
+    };
+    check("sparse", colony::Engine::Sparse, sparse);
+    check("auction", colony::Engine::Auction, auction);
+    check("auto", colony::Engine::Auto, automatic);
+  }
+}
+
+// Cells of `GridZone` (also of the extreme & invalid positions) are never the
+// zone of the unlabeled tasks.
+void GridZones() {
+  const double inf = numeric_limits<double>::infinity();
+  const double nan = numeric_limits<double>::quiet_NaN();
+  const double coordinates[] = {0, 1, -1, 32768, -32768, 65536, 1e300,
+                                -1e300, inf, -inf, nan};
+  const double cell_sizes[] = {1, 16, 0, -1, nan};
+  Case c;
+  c.generator = "grid_zones";
+  c.seed = 0;
+  for (double x : coordinates) {
+    for (double y : coordinates) {
+      for (double cell_size : cell_sizes) {
+        ++checks;
+        int zone = colony::GridZone(x, y, cell_size);
+        if (zone < 0 || zone == colony::kNoZone) {
+          return Fail(c, "double", "grid_zone", "negative zone", x, y);
+        }
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(arg, "--verbose") == 0) {
+      options.verbose = true;
+    } else if (value && strcmp(arg, "--seed") == 0) {
+      options.seed = strtoull(value, nullptr, 10), ++i;
+    } else if (value && strcmp(arg, "--cases") == 0) {
+      options.cases = atoi(value), ++i;
+    } else {
+      fprintf(stderr, "Usage: %s [--seed N] [--cases N] [--verbose]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  Test<double>(options);
+  Test<float>(options);
+  Test<int32_t>(options);
+  Test<int64_t>(options);
+  HugeCosts(options);
+  GridZones();
+  printf("%d checks, %d failures\n", checks, failures);
+  return failures ? 1 : 0;
+}